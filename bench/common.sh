@@ -0,0 +1,74 @@
+#!/bin/bash
+
+#
+# Helpers shared by the benchmark scripts
+#
+# Required variables
+#
+# $BENCH_DIR
+#
+
+TESTS_DIR=$BENCH_DIR/../tests
+
+WORK=$BENCH_DIR/work
+TEST_ROOTFS=$WORK/template
+BOOT_ROOTFS=$WORK/rootfs
+
+INIT=$BENCH_DIR/../src/init
+FIXTURE=$TESTS_DIR/fixture/init_fixture.so
+
+if [ ! -f "$INIT" ]; then echo "Build $INIT first"; exit 1; fi
+if [ ! -f "$FIXTURE" ]; then echo "Build $FIXTURE first"; exit 1; fi
+
+# Boot $TEST_ROOTFS the specified number of times with $CMDLINE and
+# $FIXTURE_LATENCY and append the fixture's stats and the timelines to the
+# results file. Init deletes the initramfs files, so each run gets a fresh
+# copy.
+boot_repeatedly() {
+    local count=$1
+    local results=$2
+
+    for ((i = 0; i < count; i++)); do
+        rm -fr "$BOOT_ROOTFS"
+        cp -R "$TEST_ROOTFS" "$BOOT_ROOTFS"
+
+        (FIXTURE_STATS=$results FIXTURE_LATENCY=$FIXTURE_LATENCY LD_PRELOAD=$FIXTURE DYLD_INSERT_LIBRARIES=$FIXTURE WORK=$BOOT_ROOTFS exec -a /init $INIT $CMDLINE) > /dev/null 2>&1
+
+        # Reboots and failures don't write a timeline
+        TIMELINE=$BOOT_ROOTFS/mnt/dev/nerves_initramfs.timeline
+        if [ -f "$TIMELINE" ]; then
+            cat "$TIMELINE" >> "$results"
+        fi
+    done
+}
+
+# Turn the per-run records into "benchmark metric median p95" lines
+summarize() {
+    awk -v bench="$1" '
+        function add(metric, value) {
+            if (!(metric in count))
+                metrics[++metric_count] = metric
+            samples[metric, ++count[metric]] = value
+        }
+        $1 == "calls" { add("calls." $2, $3) }
+        $1 == "allocs" || $1 == "alloc_bytes" || $1 == "wall_us" { add($1, $2) }
+        $1 == "phase" && $5 > $4 { add("phase." $3 "_us", $5 - $4) }
+        END {
+            for (m = 1; m <= metric_count; m++) {
+                metric = metrics[m]
+                n = count[metric]
+                for (i = 1; i <= n; i++)
+                    sorted[i] = samples[metric, i]
+                # Insertion sort is fine for a few thousand samples
+                for (i = 2; i <= n; i++) {
+                    v = sorted[i]
+                    for (j = i - 1; j > 0 && sorted[j] > v; j--)
+                        sorted[j + 1] = sorted[j]
+                    sorted[j + 1] = v
+                }
+                median = sorted[int((n + 1) / 2)]
+                p95 = sorted[int((n * 95 + 99) / 100)]
+                print bench, metric, median, p95
+            }
+        }'
+}
@@ -0,0 +1,366 @@
+// Build a fake /sys/block and /dev with lots of block devices
+//
+// This is for seeing how device probing scales. Disks get 128-entry GPTs
+// like real ones. The UUIDs are predictable so that benchmarks can look
+// for specific partitions:
+//
+//   disk N:               000000NN-0000-4000-8000-000000000000
+//   disk N, partition P:  000000NN-PPPP-4000-8000-000000000000
+//
+// NVMe namespaces are numbered before the disks so that the last disk is
+// also the last one in /sys/block. Its last partition's PARTUUID is printed
+// when done and that disk is never made corrupt.
+#include "crc32.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define GPT_ENTRIES      128
+#define GPT_ENTRY_SIZE   128
+#define GPT_TABLE_BLOCKS (GPT_ENTRIES * GPT_ENTRY_SIZE / 512)
+#define PARTITION_BLOCKS 8
+
+// Linux filesystem data
+static const uint8_t linux_type[16] = {
+    0xaf, 0x3d, 0xc6, 0x0f, 0x83, 0x84, 0x72, 0x47,
+    0x8e, 0x79, 0x3d, 0x69, 0xd8, 0x47, 0x7d, 0xe4
+};
+
+static const char *root;
+static FILE *latency_fp = NULL;
+static int partitions = 4;
+static int slow_every = 0;
+static int corrupt_every = 0;
+static unsigned int last_disk_number = 0;
+
+// Partitions are numbered like the kernel's extended devt range
+static unsigned int next_ext_minor = 0;
+
+static void usage()
+{
+    fprintf(stderr, "Usage: make_topology [options] <root>\n");
+    fprintf(stderr, "  -d <count>  Disks with GPTs (vda, vdb, ...) [16]\n");
+    fprintf(stderr, "  -n <count>  NVMe namespaces with GPTs [0]\n");
+    fprintf(stderr, "  -l <count>  Loop devices [8]\n");
+    fprintf(stderr, "  -r <count>  RAM disks [4]\n");
+    fprintf(stderr, "  -m <count>  MTD devices [0]\n");
+    fprintf(stderr, "  -p <count>  Partitions per disk (1-128) [4]\n");
+    fprintf(stderr, "  -s <n>      Make every nth disk slow\n");
+    fprintf(stderr, "  -c <n>      Make every nth disk's partition table corrupt\n");
+    fprintf(stderr, "  -L <path>   Where to write FIXTURE_LATENCY rules for the slow disks\n");
+    exit(EXIT_FAILURE);
+}
+
+static void fail(const char *what, const char *path)
+{
+    fprintf(stderr, "make_topology: %s %s: %s\n", what, path, strerror(errno));
+    exit(EXIT_FAILURE);
+}
+
+static void make_dirs(const char *path)
+{
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s", path);
+    for (char *p = tmp + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            if (mkdir(tmp, 0755) < 0 && errno != EEXIST)
+                fail("mkdir", tmp);
+            *p = '/';
+        }
+    }
+    if (mkdir(tmp, 0755) < 0 && errno != EEXIST)
+        fail("mkdir", tmp);
+}
+
+static void write_file(const char *path, const char *contents)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+        fail("create", path);
+    fputs(contents, fp);
+    fclose(fp);
+}
+
+static void make_link(const char *target, const char *path)
+{
+    if (symlink(target, path) < 0 && errno != EEXIST)
+        fail("symlink", path);
+}
+
+// Add /sys/block/<disk>[/<part>] and /sys/class/block/<name>. The fixture
+// uses the latter to fake st_rdev for /dev/<name>.
+static void add_sysfs(const char *disk, const char *part, unsigned int major, unsigned int minor, int partition_number)
+{
+    const char *name = part ? part : disk;
+    char dir[PATH_MAX];
+    char path[PATH_MAX + 16];
+    char contents[32];
+
+    if (part)
+        snprintf(dir, sizeof(dir), "%s/sys/block/%s/%s", root, disk, part);
+    else
+        snprintf(dir, sizeof(dir), "%s/sys/block/%s", root, disk);
+    make_dirs(dir);
+
+    snprintf(path, sizeof(path), "%s/dev", dir);
+    snprintf(contents, sizeof(contents), "%u:%u\n", major, minor);
+    write_file(path, contents);
+
+    if (part) {
+        snprintf(path, sizeof(path), "%s/partition", dir);
+        snprintf(contents, sizeof(contents), "%d\n", partition_number);
+        write_file(path, contents);
+    }
+
+    char target[PATH_MAX];
+    if (part)
+        snprintf(target, sizeof(target), "../../block/%s/%s", disk, part);
+    else
+        snprintf(target, sizeof(target), "../../block/%s", disk);
+    snprintf(path, sizeof(path), "%s/sys/class/block/%s", root, name);
+    make_link(target, path);
+}
+
+static int open_dev(const char *name, off_t size)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/dev/%s", root, name);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        fail("create", path);
+    if (ftruncate(fd, size) < 0)
+        fail("truncate", path);
+    return fd;
+}
+
+static void uuid_bytes(unsigned int disk, unsigned int partition, uint8_t *uuid)
+{
+    // The first three fields are little endian
+    memset(uuid, 0, 16);
+    uuid[0] = disk & 0xff;
+    uuid[1] = (disk >> 8) & 0xff;
+    uuid[2] = (disk >> 16) & 0xff;
+    uuid[3] = (disk >> 24) & 0xff;
+    uuid[4] = partition & 0xff;
+    uuid[5] = (partition >> 8) & 0xff;
+    uuid[7] = 0x40;
+    uuid[8] = 0x80;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+static void put_le64(uint8_t *p, uint64_t v)
+{
+    put_le32(p, v & 0xffffffff);
+    put_le32(p + 4, v >> 32);
+}
+
+static void write_gpt(int fd, unsigned int disk_number, bool corrupt)
+{
+    uint64_t last_lba = 2 + GPT_TABLE_BLOCKS + partitions * PARTITION_BLOCKS + GPT_TABLE_BLOCKS + 1;
+    uint8_t image[(2 + GPT_TABLE_BLOCKS) * 512];
+    memset(image, 0, sizeof(image));
+
+    // Protective MBR
+    uint8_t *mbr = image;
+    mbr[446 + 4] = 0xee;
+    put_le32(&mbr[446 + 8], 1);
+    put_le32(&mbr[446 + 12], (uint32_t) last_lba);
+    mbr[510] = 0x55;
+    mbr[511] = 0xaa;
+
+    uint8_t *entries = image + 1024;
+    for (int i = 0; i < partitions; i++) {
+        uint8_t *entry = entries + i * GPT_ENTRY_SIZE;
+        uint64_t first = 2 + GPT_TABLE_BLOCKS + i * PARTITION_BLOCKS;
+        memcpy(entry, linux_type, 16);
+        uuid_bytes(disk_number, i + 1, entry + 16);
+        put_le64(entry + 32, first);
+        put_le64(entry + 40, first + PARTITION_BLOCKS - 1);
+    }
+
+    uint8_t *header = image + 512;
+    memcpy(header, "EFI PART", 8);
+    put_le32(&header[8], 0x00010000);
+    put_le32(&header[12], 92);
+    put_le64(&header[24], 1);
+    put_le64(&header[32], last_lba);
+    put_le64(&header[40], 2 + GPT_TABLE_BLOCKS);
+    put_le64(&header[48], last_lba - GPT_TABLE_BLOCKS - 1);
+    uuid_bytes(disk_number, 0, &header[56]);
+    put_le64(&header[72], 2);
+    put_le32(&header[80], GPT_ENTRIES);
+    put_le32(&header[84], GPT_ENTRY_SIZE);
+    put_le32(&header[88], crc32buf((const char *) entries, GPT_ENTRIES * GPT_ENTRY_SIZE));
+    put_le32(&header[16], crc32buf((const char *) header, 92));
+
+    size_t len = sizeof(image);
+    if (corrupt) {
+        // Rotate through the ways that tables go bad
+        switch (disk_number % 3) {
+        case 0:
+            header[7] = 'X';
+            break;
+        case 1:
+            put_le32(&header[80], 0x10000);
+            break;
+        default:
+            len = 1024 + 512;
+            break;
+        }
+    }
+
+    if (pwrite(fd, image, len, 0) != (ssize_t) len)
+        fail("write", "GPT");
+}
+
+static void add_gpt_disk(const char *name, const char *partition_prefix, unsigned int major, unsigned int minor, unsigned int disk_number)
+{
+    bool corrupt = corrupt_every && disk_number % corrupt_every == 0 &&
+                   disk_number != last_disk_number;
+    bool slow = slow_every && disk_number % slow_every == 0;
+
+    add_sysfs(name, NULL, major, minor, 0);
+    off_t size = (2 + 2 * GPT_TABLE_BLOCKS + partitions * PARTITION_BLOCKS + 1) * 512;
+    int fd = open_dev(name, corrupt && disk_number % 3 == 2 ? 1024 + 512 : size);
+    write_gpt(fd, disk_number, corrupt);
+    close(fd);
+
+    for (int i = 1; i <= partitions; i++) {
+        char part[64];
+        snprintf(part, sizeof(part), "%s%s%d", name, partition_prefix, i);
+        add_sysfs(name, part, 259, next_ext_minor++, i);
+        close(open_dev(part, 0));
+    }
+
+    if (slow && latency_fp)
+        fprintf(latency_fp, "/dev/%s:latency=2ms,bandwidth=1M;", name);
+}
+
+static void add_plain_device(const char *name, unsigned int major, unsigned int minor, off_t size)
+{
+    add_sysfs(name, NULL, major, minor, 0);
+    close(open_dev(name, size));
+}
+
+// vda, vdb, ..., vdz, vdaa, ...
+static void disk_name(unsigned int n, char *name)
+{
+    char suffix[8];
+    int len = 0;
+    n++;
+    while (n > 0) {
+        n--;
+        suffix[len++] = 'a' + n % 26;
+        n /= 26;
+    }
+    strcpy(name, "vd");
+    for (int i = 0; i < len; i++)
+        name[2 + i] = suffix[len - 1 - i];
+    name[2 + len] = '\0';
+}
+
+int main(int argc, char *argv[])
+{
+    int disks = 16;
+    int nvmes = 0;
+    int loops = 8;
+    int rams = 4;
+    int mtds = 0;
+    const char *latency_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:n:l:r:m:p:s:c:L:")) != -1) {
+        switch (opt) {
+        case 'd': disks = atoi(optarg); break;
+        case 'n': nvmes = atoi(optarg); break;
+        case 'l': loops = atoi(optarg); break;
+        case 'r': rams = atoi(optarg); break;
+        case 'm': mtds = atoi(optarg); break;
+        case 'p': partitions = atoi(optarg); break;
+        case 's': slow_every = atoi(optarg); break;
+        case 'c': corrupt_every = atoi(optarg); break;
+        case 'L': latency_path = optarg; break;
+        default: usage();
+        }
+    }
+    if (optind + 1 != argc || partitions < 1 || partitions > GPT_ENTRIES)
+        usage();
+    root = argv[optind];
+
+    if (latency_path) {
+        latency_fp = fopen(latency_path, "w");
+        if (!latency_fp)
+            fail("create", latency_path);
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/dev", root);
+    make_dirs(path);
+    snprintf(path, sizeof(path), "%s/sys/class/block", root);
+    make_dirs(path);
+
+    unsigned int disk_number = 1;
+    last_disk_number = nvmes + disks;
+    for (int i = 0; i < nvmes; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "nvme%dn1", i);
+        add_gpt_disk(name, "p", 259, next_ext_minor++, disk_number++);
+    }
+    for (int i = 0; i < disks; i++) {
+        char name[16];
+        disk_name(i, name);
+        add_gpt_disk(name, "", 252, i * 16, disk_number++);
+    }
+    for (int i = 0; i < loops; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "loop%d", i);
+        add_plain_device(name, 7, i, 0);
+    }
+    for (int i = 0; i < rams; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "ram%d", i);
+        add_plain_device(name, 1, i, 4096 * 1024);
+    }
+    if (mtds > 0) {
+        snprintf(path, sizeof(path), "%s/proc", root);
+        make_dirs(path);
+        snprintf(path, sizeof(path), "%s/proc/mtd", root);
+        FILE *fp = fopen(path, "w");
+        if (!fp)
+            fail("create", path);
+        fprintf(fp, "dev:    size   erasesize  name\n");
+        for (int i = 0; i < mtds; i++) {
+            char name[32];
+            fprintf(fp, "mtd%d: 00100000 00002000 \"part%d\"\n", i, i);
+            snprintf(name, sizeof(name), "mtd%d", i);
+            close(open_dev(name, 1024 * 1024));
+            snprintf(name, sizeof(name), "mtdblock%d", i);
+            add_plain_device(name, 31, i, 1024 * 1024);
+        }
+        fclose(fp);
+    }
+
+    if (latency_fp)
+        fclose(latency_fp);
+
+    if (disk_number > 1)
+        printf("%08x-%04x-4000-8000-000000000000\n", disk_number - 1, partitions);
+    return 0;
+}
@@ -0,0 +1,328 @@
+// Microbenchmarks for the script engine, U-Boot environment and CRC-32
+//
+// This links the same sources as init minus main() so that the CPU-bound
+// parts can be timed without the fixture or any I/O. There's one line per
+// result so that they can be saved and compared between builds:
+//
+//   <benchmark> <size> <median ns/op> <min ns/op> <MiB/s or ->
+//
+// Each benchmark runs ROUNDS rounds of at least MIN_ROUND_NS and reports the
+// median and the fastest round. Pass a prefix like "uboot" to run a subset.
+#include "crc32.h"
+#include "script.h"
+#include "uboot_env.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ROUNDS       7
+#define MIN_ROUND_NS 50000000ULL
+
+// The script heap is sized for real configs, so long configs are evaluated
+// a few statements at a time like the REPL does. Variables carry over.
+#define CHUNK_LINES  8
+#define SCRIPT_VARS  16
+
+#define MAX_VARIABLES 128
+#define LOOKUPS       1024
+
+typedef void (*bench_fun)(void *arg);
+
+// script.c uses the one that nerves_initramfs.c defines
+struct uboot_env working_uboot_env;
+
+static const char *filter = "";
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+// Time fun(arg). Each call does ops operations that process bytes_per_op
+// bytes each, if that means anything for the benchmark.
+static void bench(const char *name, size_t size, bench_fun fun, void *arg, size_t ops, size_t bytes_per_op)
+{
+    double ns_per_op[ROUNDS];
+
+    // Warm up
+    fun(arg);
+
+    for (int r = 0; r < ROUNDS; r++) {
+        uint64_t iterations = 0;
+        uint64_t start = now_ns();
+        uint64_t elapsed;
+        do {
+            fun(arg);
+            iterations++;
+            elapsed = now_ns() - start;
+        } while (elapsed < MIN_ROUND_NS);
+        ns_per_op[r] = (double) elapsed / (iterations * ops);
+    }
+    qsort(ns_per_op, ROUNDS, sizeof(double), compare_doubles);
+
+    double median = ns_per_op[ROUNDS / 2];
+    printf("%-16s %8zu %14.1f %14.1f", name, size, median, ns_per_op[0]);
+    if (bytes_per_op)
+        printf(" %10.1f\n", bytes_per_op / median * 1e9 / (1024.0 * 1024.0));
+    else
+        printf(" %10s\n", "-");
+    fflush(stdout);
+}
+
+static int selected(const char *name)
+{
+    return strncmp(name, filter, strlen(filter)) == 0;
+}
+
+// Script parsing and evaluation
+
+struct script_config
+{
+    char **chunks;
+    int chunk_count;
+};
+
+// Lines that look like the ones in real configs, but only use functions
+// that don't do I/O. Comparisons are string to string since variables start
+// out as empty strings.
+static int append_line(char *p, int i)
+{
+    int v = i % SCRIPT_VARS;
+    int w = (i + 1) % SCRIPT_VARS;
+
+    switch (i % 5) {
+    case 0:
+        return sprintf(p, "v%d = \"value %d\"\n", v, i);
+    case 1:
+        return sprintf(p, "n%d = n%d + %d\n", v, w, i);
+    case 2:
+        return sprintf(p, "v%d == \"value %d\" -> n%d = n%d - 1\n", w, i - 1, v, v);
+    case 3:
+        return sprintf(p, "contains(v%d, \"1\") && v%d != \"value\" -> { v%d = to_upper(trim(v%d)) n%d = 0 }\n", v, w, w, v, v);
+    default:
+        return sprintf(p, "starts_with(v%d, \"VALUE\") || field(\"a:b:c\", \":\", 2) == \"b\" -> v%d = substr(v%d, 0, 5)\n", w, v, w);
+    }
+}
+
+static void script_config_init(struct script_config *config, int lines)
+{
+    config->chunk_count = (lines + CHUNK_LINES - 1) / CHUNK_LINES;
+    config->chunks = calloc(config->chunk_count, sizeof(char *));
+
+    for (int c = 0; c < config->chunk_count; c++) {
+        char *chunk = malloc(CHUNK_LINES * 128);
+        char *p = chunk;
+        for (int i = c * CHUNK_LINES; i < lines && i < (c + 1) * CHUNK_LINES; i++)
+            p += append_line(p, i);
+        config->chunks[c] = chunk;
+    }
+}
+
+static void script_config_free(struct script_config *config)
+{
+    for (int c = 0; c < config->chunk_count; c++)
+        free(config->chunks[c]);
+    free(config->chunks);
+}
+
+static void run_script(void *arg)
+{
+    const struct script_config *config = arg;
+
+    // eval_string takes ownership of its input
+    for (int c = 0; c < config->chunk_count; c++)
+        eval_string(strdup(config->chunks[c]));
+}
+
+static void bench_script()
+{
+    static const int line_counts[] = {10, 100, 1000, 10000};
+
+    if (!selected("script_eval"))
+        return;
+
+    for (size_t i = 0; i < sizeof(line_counts) / sizeof(line_counts[0]); i++) {
+        struct script_config config;
+        script_config_init(&config, line_counts[i]);
+        bench("script_eval", line_counts[i], run_script, &config, line_counts[i], 0);
+        script_config_free(&config);
+    }
+}
+
+// Variable lookups
+
+struct variable_set
+{
+    int count;
+    char names[MAX_VARIABLES][16];
+};
+
+static void lookup_variables(void *arg)
+{
+    const struct variable_set *set = arg;
+    for (int i = 0; i < LOOKUPS; i++) {
+        const struct term *value = get_variable(set->names[i % set->count]);
+        if (value->kind != term_string)
+            abort();
+    }
+}
+
+static void bench_variables()
+{
+    static const int variable_counts[] = {1, 8, 32, 128};
+    static struct variable_set set;
+
+    if (!selected("get_variable"))
+        return;
+
+    for (size_t i = 0; i < sizeof(variable_counts) / sizeof(variable_counts[0]); i++) {
+        // Start with an empty heap so that only these variables exist
+        term_gc_heap();
+        set.count = variable_counts[i];
+        for (int j = 0; j < set.count; j++) {
+            snprintf(set.names[j], sizeof(set.names[j]), "var.%d", j);
+            set_string_variable(set.names[j], "value");
+        }
+        bench("get_variable", set.count, lookup_variables, &set, LOOKUPS, 0);
+    }
+}
+
+// U-Boot environments
+
+struct uboot_buffers
+{
+    struct uboot_env env;
+    char *block;
+    char *output;
+    size_t size;
+    size_t count;
+};
+
+static void uboot_buffers_init(struct uboot_buffers *b, size_t size)
+{
+    b->size = size;
+    b->block = malloc(size);
+    b->output = malloc(size);
+
+    // Fill about 3/4 of the block with 32 byte name/value pairs
+    uboot_env_init(&b->env);
+    b->env.env_size = size;
+    b->count = (size - 4) * 3 / 4 / 32;
+    for (size_t i = 0; i < b->count; i++) {
+        char name[32];
+        char value[64];
+        snprintf(name, sizeof(name), "var%06u", (unsigned int) i);
+        snprintf(value, sizeof(value), "value-%06u-abcdefghij", (unsigned int) i);
+        uboot_env_setenv(&b->env, name, value);
+    }
+    if (uboot_env_write(&b->env, b->block) < 0)
+        abort();
+}
+
+static void uboot_buffers_free(struct uboot_buffers *b)
+{
+    uboot_env_free(&b->env);
+    free(b->block);
+    free(b->output);
+}
+
+static void read_env(void *arg)
+{
+    struct uboot_buffers *b = arg;
+    if (uboot_env_read(&b->env, b->block) < 0)
+        abort();
+}
+
+static void write_env(void *arg)
+{
+    struct uboot_buffers *b = arg;
+    if (uboot_env_write(&b->env, b->output) < 0)
+        abort();
+}
+
+static void getenv_all(void *arg)
+{
+    struct uboot_buffers *b = arg;
+    for (size_t i = 0; i < b->count; i++) {
+        char name[32];
+        const char *value;
+        snprintf(name, sizeof(name), "var%06u", (unsigned int) i);
+        if (uboot_env_getenv(&b->env, name, &value) < 0)
+            abort();
+    }
+}
+
+static void bench_uboot_env()
+{
+    static const size_t sizes[] = {16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024};
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        struct uboot_buffers b;
+        uboot_buffers_init(&b, sizes[i]);
+        if (selected("uboot_env_read"))
+            bench("uboot_env_read", b.size, read_env, &b, 1, b.size);
+        if (selected("uboot_env_write"))
+            bench("uboot_env_write", b.size, write_env, &b, 1, b.size);
+        if (selected("uboot_env_getenv"))
+            bench("uboot_env_getenv", b.size, getenv_all, &b, b.count, 0);
+        uboot_buffers_free(&b);
+    }
+}
+
+// CRC-32
+
+struct crc_buffer
+{
+    const char *data;
+    size_t size;
+};
+
+static void crc(void *arg)
+{
+    const struct crc_buffer *b = arg;
+    volatile uint32_t sink = crc32buf(b->data, b->size);
+    (void) sink;
+}
+
+static void bench_crc32()
+{
+    static const size_t sizes[] = {64, 4096, 128 * 1024, 1024 * 1024};
+
+    if (!selected("crc32buf"))
+        return;
+
+    char *data = malloc(sizes[3]);
+    for (size_t i = 0; i < sizes[3]; i++)
+        data[i] = (char) (i * 131 + 7);
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        struct crc_buffer b = {data, sizes[i]};
+        bench("crc32buf", sizes[i], crc, &b, 1, sizes[i]);
+    }
+    free(data);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+        filter = argv[1];
+
+    printf("# crc32_update() uses %s\n", crc32_implementation());
+    printf("# benchmark          size    median ns/op       min ns/op      MiB/s\n");
+    bench_script();
+    bench_variables();
+    bench_uboot_env();
+    bench_crc32();
+    return 0;
+}
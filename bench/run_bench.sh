@@ -0,0 +1,130 @@
+#!/bin/bash
+
+#
+# Boot benchmarks
+#
+# Runs init against the test fixture many times for each benchmark and
+# reports medians and 95th percentiles of the boot phase times from the
+# timeline, the calls that the fixture intercepts and allocations. Medians
+# of the calls and allocations are checked against the limits in
+# bench/thresholds. Times are only reported.
+#
+# Usage: run_bench.sh [-n iterations] [benchmark...]
+#
+
+# "readlink -f" implementation for BSD
+# This code was extracted from the Elixir shell scripts
+readlink_f () {
+    cd "$(dirname "$1")" > /dev/null
+    filename="$(basename "$1")"
+    if [ -h "$filename" ]; then
+        readlink_f "$(readlink "$filename")"
+    else
+        echo "`pwd -P`/$filename"
+    fi
+}
+
+BENCH_DIR=$(dirname $(readlink_f $0))
+THRESHOLDS=$BENCH_DIR/thresholds
+
+source "$BENCH_DIR/common.sh"
+
+ITERATIONS=1000
+if [ "$1" = "-n" ]; then
+    ITERATIONS=$2
+    shift 2
+fi
+
+BENCHMARKS=$*
+if [ -z "$BENCHMARKS" ]; then
+    BENCHMARKS=$(cd "$BENCH_DIR" && ls [0-9][0-9][0-9]_*)
+fi
+
+case $(uname -s) in
+    Darwin)
+        BASE64_DECODE=-D
+        ;;
+    *)
+        BASE64_DECODE=-d
+        ;;
+esac
+
+base64_decode() {
+    base64 $BASE64_DECODE
+}
+
+base64_decodez() {
+    base64 $BASE64_DECODE | zcat
+}
+
+# Compare "benchmark metric median p95" lines against the thresholds
+check() {
+    awk -v thresholds="$THRESHOLDS" '
+        BEGIN {
+            while ((getline line < thresholds) > 0) {
+                split(line, f)
+                if (f[1] != "" && substr(f[1], 1, 1) != "#")
+                    limit[f[1], f[2]] = f[3]
+            }
+            failed = 0
+            printf "%-16s %-28s %10s %10s %10s\n", "benchmark", "metric", "median", "p95", "limit"
+        }
+        {
+            status = ""
+            max = "-"
+            # Times vary too much between hosts to have hard limits
+            if (($1, $2) in limit && $2 !~ /_us$/) {
+                max = limit[$1, $2]
+                if ($3 > max) {
+                    status = " FAIL"
+                    failed = 1
+                }
+            }
+            printf "%-16s %-28s %10d %10d %10s%s\n", $1, $2, $3, $4, max, status
+        }
+        END { exit failed }'
+}
+
+run() {
+    BENCH=$1
+    CONFIG=$TEST_ROOTFS/nerves_initramfs.conf
+    CMDLINE_FILE=$WORK/$BENCH.cmdline
+    LATENCY_FILE=$WORK/$BENCH.latency
+    RESULTS=$WORK/$BENCH.results
+
+    # Setup a fake root directory just like the tests do. Init deletes the
+    # initramfs files, so each run gets a fresh copy.
+    rm -fr "$TEST_ROOTFS" "$BOOT_ROOTFS" "$CMDLINE_FILE" "$LATENCY_FILE" "$RESULTS"
+    mkdir -p "$TEST_ROOTFS/mnt/dev"
+    source "$TESTS_DIR/init_fixture.sh"
+    source "$BENCH_DIR/$BENCH"
+
+    if [ -e "$CMDLINE_FILE" ]; then
+        CMDLINE=$(cat "$CMDLINE_FILE")
+    else
+        CMDLINE=
+    fi
+
+    if [ -e "$LATENCY_FILE" ]; then
+        FIXTURE_LATENCY=$(cat "$LATENCY_FILE")
+    else
+        FIXTURE_LATENCY=
+    fi
+
+    boot_repeatedly "$ITERATIONS" "$RESULTS"
+
+    summarize "$BENCH" < "$RESULTS"
+}
+
+mkdir -p "$WORK"
+for BENCH in $BENCHMARKS; do
+    BENCH=$(basename "$BENCH")
+    echo "Running $BENCH..." 1>&2
+    run "$BENCH"
+done > "$WORK/summary"
+
+check < "$WORK/summary"
+RC=$?
+
+rm -fr "$WORK"
+exit $RC
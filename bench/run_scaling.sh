@@ -0,0 +1,108 @@
+#!/bin/bash
+
+#
+# Block device probe scaling
+#
+# Generates fake topologies with more and more disks using make_topology and
+# reports how finding the root filesystem by PARTUUID and creating the
+# rootdisk symlinks grow with the number of block devices. The root
+# filesystem is always on the last disk so every device gets probed.
+#
+# Each topology also has NVMe namespaces, loop and ram devices and MTD
+# devices. Use -s and -c to make every nth disk slow or corrupt.
+#
+# Usage: run_scaling.sh [-n iterations] [-s n] [-c n] [disk count...]
+#
+
+# "readlink -f" implementation for BSD
+# This code was extracted from the Elixir shell scripts
+readlink_f () {
+    cd "$(dirname "$1")" > /dev/null
+    filename="$(basename "$1")"
+    if [ -h "$filename" ]; then
+        readlink_f "$(readlink "$filename")"
+    else
+        echo "`pwd -P`/$filename"
+    fi
+}
+
+BENCH_DIR=$(dirname $(readlink_f $0))
+MAKE_TOPOLOGY=$BENCH_DIR/make_topology
+
+source "$BENCH_DIR/common.sh"
+
+if [ ! -f "$MAKE_TOPOLOGY" ]; then echo "Build $MAKE_TOPOLOGY first"; exit 1; fi
+
+ITERATIONS=20
+TOPOLOGY_OPTIONS=
+while getopts "n:s:c:" opt; do
+    case $opt in
+        n) ITERATIONS=$OPTARG ;;
+        s) TOPOLOGY_OPTIONS="$TOPOLOGY_OPTIONS -s $OPTARG" ;;
+        c) TOPOLOGY_OPTIONS="$TOPOLOGY_OPTIONS -c $OPTARG" ;;
+        *) exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+DISK_COUNTS=$*
+if [ -z "$DISK_COUNTS" ]; then
+    DISK_COUNTS="1 10 50 100 200 400"
+fi
+
+run() {
+    DISKS=$1
+    CONFIG=$TEST_ROOTFS/nerves_initramfs.conf
+    LATENCY_FILE=$WORK/$DISKS.latency
+    RESULTS=$WORK/$DISKS.results
+
+    rm -fr "$TEST_ROOTFS" "$BOOT_ROOTFS" "$LATENCY_FILE" "$RESULTS"
+    mkdir -p "$TEST_ROOTFS/mnt/dev"
+    source "$TESTS_DIR/init_fixture.sh"
+
+    ROOTFS_UUID=$("$MAKE_TOPOLOGY" -d "$DISKS" -n 2 -l 8 -r 4 -m 2 -p 8 $TOPOLOGY_OPTIONS -L "$LATENCY_FILE" "$TEST_ROOTFS")
+    if [ -z "$ROOTFS_UUID" ]; then echo "make_topology failed"; exit 1; fi
+    echo "rootfs.path=\"PARTUUID=$ROOTFS_UUID\"" > "$CONFIG"
+
+    CMDLINE=
+    FIXTURE_LATENCY=$(cat "$LATENCY_FILE")
+
+    boot_repeatedly "$ITERATIONS" "$RESULTS"
+
+    DEVICES=$(find "$TEST_ROOTFS/sys/block" -name dev | wc -l)
+    summarize "$DISKS" < "$RESULTS" | sed "s/\$/ $DEVICES/"
+}
+
+mkdir -p "$WORK"
+for DISKS in $DISK_COUNTS; do
+    echo "Running $DISKS disks..." 1>&2
+    run "$DISKS"
+done > "$WORK/summary"
+
+# One row per topology with the medians. Times are microseconds.
+awk '
+    BEGIN {
+        printf "%6s %8s %10s %10s %8s %8s %8s %10s %12s\n",
+               "disks", "devices", "resolve", "symlinks", "pread", "open", "fopen", "wall", "resolve/dev"
+    }
+    {
+        if (!($1 in devices))
+            order[++rows] = $1
+        devices[$1] = $5
+        median[$1, $2] = $3
+    }
+    END {
+        for (r = 1; r <= rows; r++) {
+            d = order[r]
+            resolve = median[d, "phase.resolve_us"]
+            printf "%6d %8d %10d %10d %8d %8d %8d %10d %12.1f\n",
+                   d, devices[d], resolve, median[d, "phase.symlinks_us"],
+                   median[d, "calls.pread"], median[d, "calls.open"],
+                   median[d, "calls.fopen"], median[d, "wall_us"],
+                   resolve / devices[d]
+        }
+    }' < "$WORK/summary"
+RC=$?
+
+rm -fr "$WORK"
+exit $RC
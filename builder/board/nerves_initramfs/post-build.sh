@@ -6,8 +6,12 @@ set -e
 # of the files in the target directory. They're
 # listed here:
 
+# fwup is only needed to revert, so it's stored compressed and nerves_initramfs
+# unpacks it when fwup_revert() runs. This keeps it from using RAM on every boot.
 if [ -e "$TARGET_DIR/usr/bin/fwup" ]; then
-    FILES="init\nusr\nusr/bin\nusr/bin/fwup"
+    gzip -9 -n -c "$TARGET_DIR/usr/bin/fwup" > "$TARGET_DIR/usr/bin/fwup.gz"
+    chmod 755 "$TARGET_DIR/usr/bin/fwup.gz"
+    FILES="init\nusr\nusr/bin\nusr/bin/fwup.gz"
 else
     FILES="init"
 fi
@@ -12,7 +12,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include "gpt.h"
 #include "util.h"
+#include "mtd.h"
 
 static struct block_device_info *alloc_blkdev()
 {
@@ -68,18 +70,10 @@ static int probe_gpt_devices(int fd, const char *devname, struct block_device_in
     if (block[510] != 0x55 || block[511] != 0xaa || block[446 + 4] != 0xee)
         return -1;
 
-    // Check GPT header
-    if (pread(fd, block, sizeof(block), 512) < 0)
-        return -1;
-
-    if (block[0] != 'E' ||
-        block[1] != 'F' ||
-        block[2] != 'I' ||
-        block[3] != ' ' ||
-        block[4] != 'P' ||
-        block[5] != 'A' ||
-        block[6] != 'R' ||
-        block[7] != 'T')
+    // Use the same checked parse as the gpt_* functions. This also falls
+    // back to the backup GPT if the primary one is damaged.
+    struct gpt gpt;
+    if (gpt_load(fd, &gpt, false) < 0)
         return -1;
 
     // Add the disk
@@ -87,42 +81,24 @@ static int probe_gpt_devices(int fd, const char *devname, struct block_device_in
     blkdev->next = *devices;
     blkdev->type = BLOCK_DEVICE_DISK;
     snprintf(blkdev->path, sizeof(blkdev->path), "/dev/%.16s", devname);
-    uuid_to_string_me(&block[56], blkdev->uuid);
+    uuid_to_string_me(gpt_disk_uuid(&gpt), blkdev->uuid);
     *devices = blkdev;
 
-    // Load the partition table
-    uint32_t partition_count = from_le32(&block[80]);
-    if (partition_count > 256)
-        return -1;
-
-    uint32_t partition_size = from_le32(&block[84]);
-    if (partition_count > 256)
-        return -1;
-
-    uint32_t partition_table_size = partition_count * partition_size;
-    uint8_t *partitions = malloc(partition_count * partition_size);
-
-    if (pread(fd, partitions, partition_table_size, 512 * 2) < 0) {
-        free(partitions);
-        return -1;
-    }
-
     const char *p = p_or_np(devname);
-    uint8_t *partition = partitions + partition_size * partition_count;
-    for (uint32_t i = partition_count; i > 0; i--) {
-        partition -= partition_size;
+    for (uint32_t i = gpt.entry_count; i > 0; i--) {
+        const uint8_t *partition = gpt_entry(&gpt, i);
 
-        if (!is_zeros(partition, 16)) {
+        if (!is_zeros(partition + GPT_ENTRY_TYPE_OFFSET, 16)) {
             struct block_device_info *blkdev = alloc_blkdev();
             blkdev->next = *devices;
             blkdev->type = BLOCK_DEVICE_PARTITION;
             snprintf(blkdev->path, sizeof(blkdev->path), "/dev/%.16s%s%d", devname, p, i);
-            uuid_to_string_me(&partition[16], blkdev->uuid);
+            uuid_to_string_me(partition + GPT_ENTRY_UUID_OFFSET, blkdev->uuid);
             *devices = blkdev;
         }
     }
 
-    free(partitions);
+    gpt_free(&gpt);
 
     return 0;
 }
@@ -255,6 +231,8 @@ static int find_block_device_by_spec(const char *spec, char *path)
         return find_block_device_by_uuid(BLOCK_DEVICE_PARTITION, &spec[9], path);
     } else if (strncmp("DISKUUID=", spec, 9) == 0) {
         return find_block_device_by_uuid(BLOCK_DEVICE_DISK, &spec[9], path);
+    } else if (strncmp("mtd:", spec, 4) == 0) {
+        return mtd_find_by_name(&spec[4], path);
     } else {
         // Assume path
         strcpy(path, spec);
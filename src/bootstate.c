@@ -0,0 +1,86 @@
+#include "bootstate.h"
+#include "crc32.h"
+
+#include <string.h>
+
+// Record layout (little endian):
+//
+//   0  magic "NBS1"
+//   4  sequence number
+//   8  attempts
+//  12  validated (0 or 1)
+//  16  slot name (NUL padded)
+//  32  CRC-32 of bytes 0-31
+//
+// The rest of the record is zero. The record for sequence number n is
+// stored at index n % BOOTSTATE_RECORD_COUNT.
+#define BOOTSTATE_MAGIC      0x3153424e
+#define BOOTSTATE_CRC_OFFSET 32
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void put_le32(uint8_t *p, uint32_t value)
+{
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = value >> 24;
+}
+
+static bool record_valid(const uint8_t *record)
+{
+    return get_le32(record) == BOOTSTATE_MAGIC &&
+           get_le32(record + BOOTSTATE_CRC_OFFSET) == crc32buf((const char *) record, BOOTSTATE_CRC_OFFSET);
+}
+
+// Return the newest valid record in the region or -1 if there aren't any.
+int bootstate_decode(const uint8_t *region, struct bootstate *state)
+{
+    int newest = -1;
+    uint32_t newest_seq = 0;
+    for (int i = 0; i < BOOTSTATE_RECORD_COUNT; i++) {
+        const uint8_t *record = region + i * BOOTSTATE_RECORD_SIZE;
+        if (!record_valid(record))
+            continue;
+
+        // Compare so that sequence numbers can wrap
+        uint32_t seq = get_le32(record + 4);
+        if (newest < 0 || (int32_t) (seq - newest_seq) > 0) {
+            newest = i;
+            newest_seq = seq;
+        }
+    }
+
+    if (newest < 0)
+        return -1;
+
+    const uint8_t *record = region + newest * BOOTSTATE_RECORD_SIZE;
+    state->seq = newest_seq;
+    state->attempts = get_le32(record + 8);
+    state->validated = record[12] != 0;
+    memcpy(state->slot, record + 16, BOOTSTATE_SLOT_LEN);
+    state->slot[BOOTSTATE_SLOT_LEN - 1] = '\0';
+    return newest;
+}
+
+void bootstate_encode(const struct bootstate *state, uint8_t *record)
+{
+    memset(record, 0, BOOTSTATE_RECORD_SIZE);
+    put_le32(record, BOOTSTATE_MAGIC);
+    put_le32(record + 4, state->seq);
+    put_le32(record + 8, state->attempts);
+    record[12] = state->validated ? 1 : 0;
+    // The record is zeroed, so this is always NUL terminated
+    size_t slot_len = strnlen(state->slot, BOOTSTATE_SLOT_LEN - 1);
+    memcpy(record + 16, state->slot, slot_len);
+    put_le32(record + BOOTSTATE_CRC_OFFSET, crc32buf((const char *) record, BOOTSTATE_CRC_OFFSET));
+}
+
+// Return where the record for state belongs
+int bootstate_record_index(const struct bootstate *state)
+{
+    return state->seq % BOOTSTATE_RECORD_COUNT;
+}
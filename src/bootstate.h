@@ -0,0 +1,28 @@
+#ifndef BOOTSTATE_H
+#define BOOTSTATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The boot state region holds a ring of fixed size records. Each update
+// writes the next record with a higher sequence number, so it costs one
+// sector write and a torn write only loses the newest update.
+#define BOOTSTATE_RECORD_SIZE  512
+#define BOOTSTATE_RECORD_COUNT 8
+#define BOOTSTATE_REGION_SIZE  (BOOTSTATE_RECORD_SIZE * BOOTSTATE_RECORD_COUNT)
+
+#define BOOTSTATE_SLOT_LEN 16
+
+struct bootstate
+{
+    uint32_t seq;
+    char slot[BOOTSTATE_SLOT_LEN];
+    uint32_t attempts;
+    bool validated;
+};
+
+int bootstate_decode(const uint8_t *region, struct bootstate *state);
+void bootstate_encode(const struct bootstate *state, uint8_t *record);
+int bootstate_record_index(const struct bootstate *state);
+
+#endif // BOOTSTATE_H
@@ -0,0 +1,110 @@
+#include "bootstats.h"
+#include "crc32.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Sector layout (little endian):
+//
+//   0  magic "NBT1"
+//   4  number of valid entries
+//   8  index of the next entry to write
+//  16  entries (28 bytes each)
+// 508  CRC-32 of bytes 0-507
+//
+// Entry layout:
+//
+//   0  total time in microseconds
+//   4  slowest phase time in microseconds
+//   8  slowest phase name (NUL padded)
+//  24  flags (bit 0 is set if a fallback was taken)
+#define BOOTSTATS_MAGIC          0x3154424e
+#define BOOTSTATS_ENTRIES_OFFSET 16
+#define BOOTSTATS_ENTRY_SIZE     28
+#define BOOTSTATS_FLAGS_OFFSET   (8 + BOOTSTATS_PHASE_LEN)
+#define BOOTSTATS_CRC_OFFSET     (BOOTSTATS_SIZE - 4)
+
+#define BOOTSTATS_FLAG_FALLBACK  0x01
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void put_le32(uint8_t *p, uint32_t value)
+{
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = value >> 24;
+}
+
+int bootstats_decode(const uint8_t *sector, struct bootstats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    if (get_le32(sector) != BOOTSTATS_MAGIC ||
+        get_le32(sector + BOOTSTATS_CRC_OFFSET) != crc32buf((const char *) sector, BOOTSTATS_CRC_OFFSET))
+        return -1;
+
+    uint32_t count = get_le32(sector + 4);
+    uint32_t next = get_le32(sector + 8);
+    if (count > BOOTSTATS_MAX_ENTRIES || next >= BOOTSTATS_MAX_ENTRIES)
+        return -1;
+
+    stats->count = count;
+    stats->next = next;
+    for (int i = 0; i < BOOTSTATS_MAX_ENTRIES; i++) {
+        const uint8_t *p = sector + BOOTSTATS_ENTRIES_OFFSET + i * BOOTSTATS_ENTRY_SIZE;
+        struct bootstats_entry *entry = &stats->entries[i];
+        entry->total_us = get_le32(p);
+        entry->slowest_us = get_le32(p + 4);
+        memcpy(entry->slowest_phase, p + 8, BOOTSTATS_PHASE_LEN);
+        entry->slowest_phase[BOOTSTATS_PHASE_LEN - 1] = '\0';
+        entry->fallback = (p[BOOTSTATS_FLAGS_OFFSET] & BOOTSTATS_FLAG_FALLBACK) != 0;
+    }
+    return 0;
+}
+
+void bootstats_encode(const struct bootstats *stats, uint8_t *sector)
+{
+    memset(sector, 0, BOOTSTATS_SIZE);
+    put_le32(sector, BOOTSTATS_MAGIC);
+    put_le32(sector + 4, stats->count);
+    put_le32(sector + 8, stats->next);
+    for (int i = 0; i < BOOTSTATS_MAX_ENTRIES; i++) {
+        uint8_t *p = sector + BOOTSTATS_ENTRIES_OFFSET + i * BOOTSTATS_ENTRY_SIZE;
+        const struct bootstats_entry *entry = &stats->entries[i];
+        put_le32(p, entry->total_us);
+        put_le32(p + 4, entry->slowest_us);
+        memcpy(p + 8, entry->slowest_phase, strnlen(entry->slowest_phase, BOOTSTATS_PHASE_LEN - 1));
+        p[BOOTSTATS_FLAGS_OFFSET] = entry->fallback ? BOOTSTATS_FLAG_FALLBACK : 0;
+    }
+    put_le32(sector + BOOTSTATS_CRC_OFFSET, crc32buf((const char *) sector, BOOTSTATS_CRC_OFFSET));
+}
+
+void bootstats_add(struct bootstats *stats, const struct bootstats_entry *entry)
+{
+    stats->entries[stats->next] = *entry;
+    stats->next = (stats->next + 1) % BOOTSTATS_MAX_ENTRIES;
+    if (stats->count < BOOTSTATS_MAX_ENTRIES)
+        stats->count++;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+// Nearest-rank percentile. The values are sorted in place.
+uint32_t bootstats_percentile(uint32_t *values, int count, int percent)
+{
+    if (count == 0)
+        return 0;
+
+    qsort(values, count, sizeof(uint32_t), compare_u32);
+    int rank = (percent * count + 99) / 100;
+    return values[rank > 0 ? rank - 1 : 0];
+}
@@ -0,0 +1,35 @@
+#ifndef BOOTSTATS_H
+#define BOOTSTATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Timing summaries of recent boots are kept in one 512 byte sector so that
+// recording a boot costs one sector write. The oldest entry is replaced
+// once it's full.
+#define BOOTSTATS_SIZE        512
+#define BOOTSTATS_MAX_ENTRIES 16
+#define BOOTSTATS_PHASE_LEN   16 // Fits "setup_initramfs"
+
+struct bootstats_entry
+{
+    uint32_t total_us;
+    uint32_t slowest_us;
+    char slowest_phase[BOOTSTATS_PHASE_LEN];
+    bool fallback;
+};
+
+struct bootstats
+{
+    uint32_t count; // Valid entries
+    uint32_t next;  // Where the next entry goes
+    struct bootstats_entry entries[BOOTSTATS_MAX_ENTRIES];
+};
+
+int bootstats_decode(const uint8_t *sector, struct bootstats *stats);
+void bootstats_encode(const struct bootstats *stats, uint8_t *sector);
+void bootstats_add(struct bootstats *stats, const struct bootstats_entry *entry);
+
+uint32_t bootstats_percentile(uint32_t *values, int count, int percent);
+
+#endif // BOOTSTATS_H
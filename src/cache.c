@@ -0,0 +1,70 @@
+#include "cache.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Results memoized by cmd_cached() and readfile_cached(). Entries live in
+// malloc'd memory rather than the script heap so that they survive heap
+// collection between statements and stay valid for the whole boot.
+#define CACHE_BUCKETS 64
+
+struct cache_entry
+{
+    struct cache_entry *next;
+    uint32_t hash;
+    size_t key_len;
+    char *value;
+    char key[];
+};
+
+static struct cache_entry *buckets[CACHE_BUCKETS];
+
+static struct cache_entry *find_entry(const char *key, size_t key_len, uint32_t hash)
+{
+    for (struct cache_entry *e = buckets[hash % CACHE_BUCKETS]; e; e = e->next) {
+        if (e->hash == hash && e->key_len == key_len && memcmp(e->key, key, key_len) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+const char *cache_lookup(const char *key, size_t key_len)
+{
+    struct cache_entry *e = find_entry(key, key_len, hash_bytes(key, key_len));
+    return e ? e->value : NULL;
+}
+
+void cache_store(const char *key, size_t key_len, const char *value)
+{
+    uint32_t hash = hash_bytes(key, key_len);
+    struct cache_entry *e = find_entry(key, key_len, hash);
+    if (e) {
+        free(e->value);
+        e->value = strdup(value);
+        return;
+    }
+
+    // Keys may contain '\0' separators, so store them with a length.
+    e = malloc(sizeof(struct cache_entry) + key_len);
+    e->hash = hash;
+    e->key_len = key_len;
+    memcpy(e->key, key, key_len);
+    e->value = strdup(value);
+    e->next = buckets[hash % CACHE_BUCKETS];
+    buckets[hash % CACHE_BUCKETS] = e;
+}
+
+void cache_clear(void)
+{
+    for (int i = 0; i < CACHE_BUCKETS; i++) {
+        struct cache_entry *e = buckets[i];
+        while (e) {
+            struct cache_entry *next = e->next;
+            free(e->value);
+            free(e);
+            e = next;
+        }
+        buckets[i] = NULL;
+    }
+}
@@ -0,0 +1,10 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+
+const char *cache_lookup(const char *key, size_t key_len);
+void cache_store(const char *key, size_t key_len, const char *value);
+void cache_clear(void);
+
+#endif // CACHE_H
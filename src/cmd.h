@@ -1,6 +1,30 @@
 #ifndef CMD_H
 #define CMD_H
 
-int system_cmd(char *const *argv, char *output_buffer, int length);
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct cmd_options
+{
+    int timeout_ms;   // 0 to wait forever
+    int nice;         // 0 to inherit
+    int ioprio_class; // 0 to inherit, otherwise IOPRIO_CLASS_RT/BE/IDLE (1-3)
+    int ioprio_level; // 0-7 within the class
+};
+
+struct cmd_process
+{
+    pid_t pid;
+    int output_fd;
+    uint64_t deadline_ms; // 0 when there's no timeout
+    bool timed_out;
+};
+
+int cmd_spawn(char *const *argv, const struct cmd_options *options, struct cmd_process *process);
+int cmd_join(struct cmd_process *process, char **output, size_t max_output);
+
+int system_cmd(char *const *argv, const struct cmd_options *options, char *output_buffer, int length);
 
 #endif // CMD_H
@@ -50,6 +50,8 @@ int sigprocmask_noop(int how, const sigset_t *restrict set, sigset_t *restrict o
 
 #define mount(a,b,c,d,e) mount(a,b,d, (void*) c)
 #define umount(a) unmount(a, 0)
+#define umount2(a,b) unmount(a, 0)
+#define MNT_DETACH 2
 
 // Missing SOCK_CLOEXEC
 #define SOCK_CLOEXEC  02000000
@@ -62,4 +64,10 @@ int sigprocmask_noop(int how, const sigset_t *restrict set, sigset_t *restrict o
 #define SIOCGIFINDEX SIOCGIFMTU
 #define ifr_ifindex         ifr_ifru.ifru_mtu
 
+// No suspend-aware clock
+#define CLOCK_BOOTTIME CLOCK_MONOTONIC
+
+// fdatasync isn't declared on all versions of macOS
+#define fdatasync(fd) fsync(fd)
+
 #endif
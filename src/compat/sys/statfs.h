@@ -0,0 +1,7 @@
+#ifndef COMPAT_SYS_STATFS_H
+#define COMPAT_SYS_STATFS_H
+
+// statfs() is in sys/mount.h on macOS
+#include <sys/mount.h>
+
+#endif
@@ -1,4 +1,21 @@
-#include "crc32.h"
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CRC32_PCLMUL_TARGET __attribute__((target("pclmul,sse4.1")))
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#ifdef __clang__
+#define CRC32_ARMV8_TARGET __attribute__((target("crc")))
+#else
+#define CRC32_ARMV8_TARGET __attribute__((target("+crc")))
+#endif
+#endif
 
 // See https://github.com/panzi/CRC-and-checksum-functions
 
@@ -113,13 +130,236 @@ static const uint32_t crc_32_tab[256] = { /* CRC polynomial 0xedb88320 */
 #define UPDC32(octet,crc) (crc_32_tab[((crc)\
      ^ ((uint8_t)octet)) & 0xff] ^ ((crc) >> 8))
 
-uint32_t crc32buf(const char *buf, size_t len)
+uint32_t crc32_update_bytewise(uint32_t crc, const uint8_t *buf, size_t len)
 {
-      uint32_t crc32 = 0xFFFFFFFF;
       for ( ; len; --len, ++buf)
       {
-            crc32 = UPDC32(*buf, crc32);
+            crc = UPDC32(*buf, crc);
       }
 
-      return ~crc32;
+      return crc;
+}
+
+// Slicing-by-8 processes 8 bytes per step using 8 tables derived from
+// crc_32_tab. They're filled in on first use.
+static uint32_t crc_32_slice_tab[8][256];
+static bool crc_32_slice_tab_ready = false;
+
+static void init_slice_tables()
+{
+    crc_32_slice_tab_ready = true;
+    for (int i = 0; i < 256; i++) {
+        uint32_t crc = crc_32_tab[i];
+        crc_32_slice_tab[0][i] = crc;
+        for (int k = 1; k < 8; k++) {
+            crc = crc_32_tab[crc & 0xff] ^ (crc >> 8);
+            crc_32_slice_tab[k][i] = crc;
+        }
+    }
+}
+
+uint32_t crc32_update_slicing8(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    if (!crc_32_slice_tab_ready)
+        init_slice_tables();
+
+    while (len >= 8) {
+        uint32_t one = crc ^ (buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t) buf[3] << 24));
+        uint32_t two = buf[4] | (buf[5] << 8) | (buf[6] << 16) | ((uint32_t) buf[7] << 24);
+        crc = crc_32_slice_tab[7][one & 0xff] ^
+              crc_32_slice_tab[6][(one >> 8) & 0xff] ^
+              crc_32_slice_tab[5][(one >> 16) & 0xff] ^
+              crc_32_slice_tab[4][one >> 24] ^
+              crc_32_slice_tab[3][two & 0xff] ^
+              crc_32_slice_tab[2][(two >> 8) & 0xff] ^
+              crc_32_slice_tab[1][(two >> 16) & 0xff] ^
+              crc_32_slice_tab[0][two >> 24];
+        buf += 8;
+        len -= 8;
+    }
+    return crc32_update_bytewise(crc, buf, len);
+}
+
+#if defined(__x86_64__)
+// Fold 64 bytes at a time with carry-less multiplies and then Barrett
+// reduce. See Intel's "Fast CRC Computation for Generic Polynomials Using
+// PCLMULQDQ Instruction". The constants are for the bit-reflected CRC-32
+// polynomial and match the ones in Chromium's zlib. len must be at least 64
+// and a multiple of 16.
+CRC32_PCLMUL_TARGET
+static uint32_t crc32_pclmul_fold(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    static const uint64_t __attribute__((aligned(16))) k1k2[] = {0x0154442bd4, 0x01c6e41596};
+    static const uint64_t __attribute__((aligned(16))) k3k4[] = {0x01751997d0, 0x00ccaa009e};
+    static const uint64_t __attribute__((aligned(16))) k5k0[] = {0x0163cd6124, 0x0000000000};
+    static const uint64_t __attribute__((aligned(16))) poly[] = {0x01db710641, 0x01f7011641};
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i *) (buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *) (buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *) (buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *) (buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    x0 = _mm_load_si128((const __m128i *) k1k2);
+    buf += 64;
+    len -= 64;
+
+    // Fold four 128-bit lanes in parallel
+    while (len >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        y5 = _mm_loadu_si128((const __m128i *) (buf + 0x00));
+        y6 = _mm_loadu_si128((const __m128i *) (buf + 0x10));
+        y7 = _mm_loadu_si128((const __m128i *) (buf + 0x20));
+        y8 = _mm_loadu_si128((const __m128i *) (buf + 0x30));
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+        buf += 64;
+        len -= 64;
+    }
+
+    // Fold the four lanes into one
+    x0 = _mm_load_si128((const __m128i *) k3k4);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // Fold any remaining 16 byte blocks
+    while (len >= 16) {
+        x2 = _mm_loadu_si128((const __m128i *) buf);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        buf += 16;
+        len -= 16;
+    }
+
+    // Fold 128 bits down to 64
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_loadl_epi64((const __m128i *) k5k0);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduce to 32 bits
+    x0 = _mm_load_si128((const __m128i *) poly);
+
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t) _mm_extract_epi32(x1, 1);
+}
+
+static uint32_t crc32_update_pclmul(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    if (len >= 64) {
+        size_t folded = len & ~(size_t) 15;
+        crc = crc32_pclmul_fold(crc, buf, folded);
+        buf += folded;
+        len -= folded;
+    }
+    return crc32_update_slicing8(crc, buf, len);
+}
+#elif defined(__aarch64__)
+CRC32_ARMV8_TARGET
+static uint32_t crc32_update_armv8(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    while (len > 0 && ((uintptr_t) buf & 7) != 0) {
+        crc = __crc32b(crc, *buf++);
+        len--;
+    }
+
+    while (len >= 8) {
+        uint64_t value;
+        memcpy(&value, buf, sizeof(value));
+        crc = __crc32d(crc, value);
+        buf += 8;
+        len -= 8;
+    }
+
+    while (len > 0) {
+        crc = __crc32b(crc, *buf++);
+        len--;
+    }
+    return crc;
+}
+#endif
+
+static uint32_t crc32_update_select(uint32_t crc, const uint8_t *buf, size_t len);
+
+static uint32_t (*crc32_update_impl)(uint32_t crc, const uint8_t *buf, size_t len) = crc32_update_select;
+static const char *crc32_impl_name = "none";
+
+// Pick the fastest implementation that the CPU supports the first time
+// that it's needed.
+static uint32_t crc32_update_select(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    crc32_update_impl = crc32_update_slicing8;
+    crc32_impl_name = "slicing-by-8";
+
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+        crc32_update_impl = crc32_update_pclmul;
+        crc32_impl_name = "pclmul";
+    }
+#elif defined(__aarch64__)
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        crc32_update_impl = crc32_update_armv8;
+        crc32_impl_name = "armv8-crc32";
+    }
+#endif
+
+    return crc32_update_impl(crc, buf, len);
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    return crc32_update_impl(crc, buf, len);
+}
+
+const char *crc32_implementation()
+{
+    if (crc32_update_impl == crc32_update_select)
+        crc32_update_select(0, NULL, 0);
+
+    return crc32_impl_name;
+}
+
+uint32_t crc32buf(const char *buf, size_t len)
+{
+    return ~crc32_update(0xFFFFFFFF, (const uint8_t *) buf, len);
 }
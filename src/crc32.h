@@ -6,4 +6,13 @@
 
 uint32_t crc32buf(const char *buf, size_t len);
 
+// Update a CRC-32 register that starts at 0xffffffff. Invert the result to
+// get the CRC. crc32_update() uses the fastest implementation for the CPU.
+uint32_t crc32_update(uint32_t crc, const uint8_t *buf, size_t len);
+const char *crc32_implementation(void);
+
+// Portable implementations for testing and benchmarking
+uint32_t crc32_update_bytewise(uint32_t crc, const uint8_t *buf, size_t len);
+uint32_t crc32_update_slicing8(uint32_t crc, const uint8_t *buf, size_t len);
+
 #endif // CRC32_H
@@ -0,0 +1,241 @@
+#include "gpt.h"
+#include "crc32.h"
+#include "util.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The primary GPT header is at LBA 1 and its entries normally start right
+// after it. Reading this much gets both with one I/O.
+#define GPT_PRIMARY_READ_SIZE (33 * 512)
+#define GPT_MAX_ENTRIES_SIZE  (1024 * 1024)
+
+// Parsed GPTs by the spec that the script used for the disk so that picking
+// a slot with gpt_priority(), gpt_tries() and gpt_successful() reads each
+// disk once
+struct gpt_cache_entry
+{
+    struct gpt_cache_entry *next;
+    char *spec;
+    struct gpt gpt;
+};
+
+static struct gpt_cache_entry *gpt_cache = NULL;
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+    return get_le32(p) | ((uint64_t) get_le32(p + 4) << 32);
+}
+
+static void put_le32(uint8_t *p, uint32_t value)
+{
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = value >> 24;
+}
+
+static void put_le64(uint8_t *p, uint64_t value)
+{
+    put_le32(p, (uint32_t) value);
+    put_le32(p + 4, (uint32_t) (value >> 32));
+}
+
+static uint32_t header_crc32(const struct gpt *gpt)
+{
+    uint8_t header[512];
+    memcpy(header, gpt->header, gpt->header_size);
+    memset(&header[16], 0, 4);
+    return crc32buf((const char *) header, gpt->header_size);
+}
+
+static uint32_t entries_crc32(const struct gpt *gpt)
+{
+    return crc32buf((const char *) gpt->entries, gpt->entries_size);
+}
+
+void gpt_free(struct gpt *gpt)
+{
+    free(gpt->entries);
+    gpt->entries = NULL;
+}
+
+// Block device probing looks at every disk, so it doesn't log why ones
+// without a usable GPT were skipped.
+#define LOAD_ERR_RETURN(MSG, ...) do { if (verbose) warn(MSG, ## __VA_ARGS__); return -1; } while (0)
+
+static int load_gpt(int fd, uint64_t header_lba, struct gpt *gpt, bool verbose)
+{
+    memset(gpt, 0, sizeof(*gpt));
+    gpt->header_lba = header_lba;
+
+    size_t read_size = header_lba == 1 ? GPT_PRIMARY_READ_SIZE : 512;
+    uint8_t *buffer = malloc(read_size);
+    ssize_t amount_read = pread(fd, buffer, read_size, header_lba * 512);
+    if (amount_read < 512 || memcmp(buffer, "EFI PART", 8) != 0) {
+        free(buffer);
+        LOAD_ERR_RETURN("No GPT header at LBA %llu", (unsigned long long) header_lba);
+    }
+    memcpy(gpt->header, buffer, 512);
+
+    gpt->header_size = get_le32(&gpt->header[12]);
+    gpt->alternate_lba = get_le64(&gpt->header[32]);
+    gpt->entries_lba = get_le64(&gpt->header[72]);
+    gpt->entry_count = get_le32(&gpt->header[80]);
+    gpt->entry_size = get_le32(&gpt->header[84]);
+    // Multiply in 64 bits so that a bad header can't wrap the size to
+    // something small and still pass the checks.
+    uint64_t entries_size = (uint64_t) gpt->entry_count * gpt->entry_size;
+    if (gpt->header_size < 92 || gpt->header_size > 512 ||
+        gpt->entry_size < 128 || (gpt->entry_size & (gpt->entry_size - 1)) != 0 ||
+        entries_size > GPT_MAX_ENTRIES_SIZE ||
+        get_le32(&gpt->header[16]) != header_crc32(gpt)) {
+        free(buffer);
+        LOAD_ERR_RETURN("Invalid GPT header at LBA %llu", (unsigned long long) header_lba);
+    }
+    gpt->entries_size = (size_t) entries_size;
+
+    // Keep whole sectors so that updated sectors can be written back as is
+    size_t sectors_size = (gpt->entries_size + 511) & ~(size_t) 511;
+    gpt->entries = malloc(sectors_size);
+    if (gpt->entries_lba == header_lba + 1 && (ssize_t) (512 + sectors_size) <= amount_read) {
+        memcpy(gpt->entries, buffer + 512, sectors_size);
+    } else if (pread(fd, gpt->entries, sectors_size, gpt->entries_lba * 512) != (ssize_t) sectors_size) {
+        free(buffer);
+        gpt_free(gpt);
+        LOAD_ERR_RETURN("Could not read GPT entries at LBA %llu", (unsigned long long) gpt->entries_lba);
+    }
+    free(buffer);
+
+    if (get_le32(&gpt->header[88]) != entries_crc32(gpt)) {
+        gpt_free(gpt);
+        LOAD_ERR_RETURN("GPT entries CRC mismatch for header at LBA %llu", (unsigned long long) header_lba);
+    }
+    return 0;
+}
+
+static int load_backup_gpt(int fd, const struct gpt *primary, struct gpt *backup, bool verbose)
+{
+    uint64_t backup_lba;
+    if (primary) {
+        backup_lba = primary->alternate_lba;
+    } else {
+        off_t size = lseek(fd, 0, SEEK_END);
+        if (size < 1024)
+            return -1;
+        backup_lba = size / 512 - 1;
+    }
+    return load_gpt(fd, backup_lba, backup, verbose);
+}
+
+int gpt_load(int fd, struct gpt *gpt, bool verbose)
+{
+    // Use the backup GPT if the primary one is damaged
+    if (load_gpt(fd, 1, gpt, verbose) < 0 && load_backup_gpt(fd, NULL, gpt, verbose) < 0)
+        return -1;
+    return 0;
+}
+
+const uint8_t *gpt_disk_uuid(const struct gpt *gpt)
+{
+    return &gpt->header[56];
+}
+
+// Partitions are numbered from 1. Returns NULL if there's no such entry.
+const uint8_t *gpt_entry(const struct gpt *gpt, int partition)
+{
+    if (partition < 1 || (uint32_t) partition > gpt->entry_count)
+        return NULL;
+
+    return gpt->entries + (size_t) (partition - 1) * gpt->entry_size;
+}
+
+uint64_t gpt_entry_attributes(const uint8_t *entry)
+{
+    return get_le64(entry + GPT_ENTRY_ATTRIBUTES_OFFSET);
+}
+
+const struct gpt *gpt_cache_lookup(const char *spec)
+{
+    for (struct gpt_cache_entry *e = gpt_cache; e; e = e->next) {
+        if (strcmp(e->spec, spec) == 0)
+            return &e->gpt;
+    }
+    return NULL;
+}
+
+// The cache takes over the entries
+const struct gpt *gpt_cache_store(const char *spec, struct gpt *gpt)
+{
+    struct gpt_cache_entry *e = malloc(sizeof(struct gpt_cache_entry));
+    e->spec = strdup(spec);
+    e->gpt = *gpt;
+    e->next = gpt_cache;
+    gpt_cache = e;
+
+    gpt->entries = NULL;
+    return &e->gpt;
+}
+
+void gpt_cache_clear(void)
+{
+    while (gpt_cache) {
+        struct gpt_cache_entry *next = gpt_cache->next;
+        gpt_free(&gpt_cache->gpt);
+        free(gpt_cache->spec);
+        free(gpt_cache);
+        gpt_cache = next;
+    }
+}
+
+static int update_gpt(int fd, struct gpt *gpt, int partition, uint64_t mask, uint64_t attributes)
+{
+    uint8_t *p = (uint8_t *) gpt_entry(gpt, partition) + GPT_ENTRY_ATTRIBUTES_OFFSET;
+    put_le64(p, (get_le64(p) & ~mask) | (attributes & mask));
+
+    put_le32(&gpt->header[88], entries_crc32(gpt));
+    put_le32(&gpt->header[16], header_crc32(gpt));
+
+    // Only the sector with the entry and the header sector change
+    size_t sector_offset = (p - gpt->entries) & ~(size_t) 511;
+    off_t sector = gpt->entries_lba * 512 + sector_offset;
+    if (pwrite(fd, gpt->entries + sector_offset, 512, sector) != 512 ||
+        pwrite(fd, gpt->header, 512, gpt->header_lba * 512) != 512 ||
+        fdatasync(fd) < 0)
+        ERR_RETURN("Could not update GPT at LBA %llu", (unsigned long long) gpt->header_lba);
+
+    return 0;
+}
+
+// Only the attribute bits in mask are changed
+int gpt_write_attributes(int fd, int partition, uint64_t mask, uint64_t attributes)
+{
+    struct gpt primary;
+    struct gpt backup;
+    if (load_gpt(fd, 1, &primary, true) < 0)
+        return -1;
+    if (load_backup_gpt(fd, &primary, &backup, true) < 0) {
+        gpt_free(&primary);
+        return -1;
+    }
+
+    // Update the backup first so that there's always one good copy if the
+    // primary update gets interrupted.
+    int rc = -1;
+    if (!gpt_entry(&primary, partition) || !gpt_entry(&backup, partition))
+        warn("Invalid GPT partition number %d", partition);
+    else if (update_gpt(fd, &backup, partition, mask, attributes) == 0 &&
+             update_gpt(fd, &primary, partition, mask, attributes) == 0)
+        rc = 0;
+
+    gpt_free(&primary);
+    gpt_free(&backup);
+    return rc;
+}
@@ -0,0 +1,46 @@
+#ifndef GPT_H
+#define GPT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// ChromeOS style A/B attributes in the GPT partition entry attribute field
+#define GPT_ATTR_PRIORITY_SHIFT   48
+#define GPT_ATTR_PRIORITY_MASK    0xfULL
+#define GPT_ATTR_TRIES_SHIFT      52
+#define GPT_ATTR_TRIES_MASK       0xfULL
+#define GPT_ATTR_SUCCESSFUL_SHIFT 56
+#define GPT_ATTR_SUCCESSFUL_MASK  0x1ULL
+
+#define GPT_ENTRY_TYPE_OFFSET       0
+#define GPT_ENTRY_UUID_OFFSET       16
+#define GPT_ENTRY_ATTRIBUTES_OFFSET 48
+
+// A GPT header and its partition entries after the CRCs have been checked
+struct gpt
+{
+    uint64_t header_lba;
+    uint8_t header[512];
+    uint32_t header_size;
+    uint64_t alternate_lba;
+    uint64_t entries_lba;
+    uint32_t entry_count;
+    uint32_t entry_size;
+    size_t entries_size;
+    uint8_t *entries;
+};
+
+int gpt_load(int fd, struct gpt *gpt, bool verbose);
+void gpt_free(struct gpt *gpt);
+const uint8_t *gpt_disk_uuid(const struct gpt *gpt);
+const uint8_t *gpt_entry(const struct gpt *gpt, int partition);
+uint64_t gpt_entry_attributes(const uint8_t *entry);
+
+const struct gpt *gpt_cache_lookup(const char *spec);
+const struct gpt *gpt_cache_store(const char *spec, struct gpt *gpt);
+void gpt_cache_clear(void);
+
+int gpt_write_attributes(int fd, int partition, uint64_t mask, uint64_t attributes);
+
+#endif // GPT_H
@@ -0,0 +1,488 @@
+#include "inflate.h"
+#include "crc32.h"
+#include "util.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// A small RFC 1951 inflater. It's only used for payloads that are unpacked
+// on demand, so it favors size over speed and decodes Huffman codes one bit
+// at a time. The input is read and the output written in small pieces so
+// that neither has to fit in RAM on top of the files themselves.
+
+#define MAX_BITS         15
+#define MAX_LITLEN_CODES 288
+#define MAX_DIST_CODES   30
+#define MAX_CODES        (MAX_LITLEN_CODES + MAX_DIST_CODES)
+
+#define INPUT_CHUNK_SIZE 4096
+#define WINDOW_SIZE      32768 // The farthest back that deflate can refer to
+
+#define GZIP_FHCRC    0x02
+#define GZIP_FEXTRA   0x04
+#define GZIP_FNAME    0x08
+#define GZIP_FCOMMENT 0x10
+
+struct huffman
+{
+    uint16_t count[MAX_BITS + 1];
+    uint16_t symbol[MAX_LITLEN_CODES];
+};
+
+struct inflate_state
+{
+    int in_fd;
+    uint8_t in[INPUT_CHUNK_SIZE];
+    size_t in_len;
+    size_t in_pos;
+    uint32_t bit_buffer;
+    int bit_count;
+
+    // The output goes through the window on its way to out_fd. It's written
+    // out each time that it fills up.
+    int out_fd;
+    uint8_t window[WINDOW_SIZE];
+    uint64_t out_len;
+    uint32_t crc;
+    bool write_failed;
+};
+
+static const uint16_t length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577
+};
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// Returns the next byte or -1 if the input ran out
+static int get_byte(struct inflate_state *s)
+{
+    if (s->in_pos == s->in_len) {
+        ssize_t amount_read = read(s->in_fd, s->in, sizeof(s->in));
+        if (amount_read <= 0)
+            return -1;
+        s->in_len = amount_read;
+        s->in_pos = 0;
+    }
+    return s->in[s->in_pos++];
+}
+
+// Returns the next `need` bits or -1 if the input ran out
+static int get_bits(struct inflate_state *s, int need)
+{
+    uint32_t value = s->bit_buffer;
+    while (s->bit_count < need) {
+        int byte = get_byte(s);
+        if (byte < 0)
+            return -1;
+        value |= (uint32_t) byte << s->bit_count;
+        s->bit_count += 8;
+    }
+    s->bit_buffer = value >> need;
+    s->bit_count -= need;
+    return (int) (value & ((1U << need) - 1));
+}
+
+static int flush_window(struct inflate_state *s, size_t len)
+{
+    s->crc = crc32_update(s->crc, s->window, len);
+
+    size_t written = 0;
+    while (written < len) {
+        ssize_t amount = write(s->out_fd, &s->window[written], len - written);
+        if (amount <= 0) {
+            s->write_failed = true;
+            return -1;
+        }
+        written += amount;
+    }
+    return 0;
+}
+
+static int put_byte(struct inflate_state *s, uint8_t byte)
+{
+    s->window[s->out_len++ % WINDOW_SIZE] = byte;
+    if (s->out_len % WINDOW_SIZE == 0)
+        return flush_window(s, WINDOW_SIZE);
+    return 0;
+}
+
+// Build a canonical Huffman decoding table. Returns 0 for a complete code,
+// a positive number for an incomplete one and -1 if it's over-subscribed.
+static int build_huffman(struct huffman *h, const uint8_t *lengths, int n)
+{
+    memset(h->count, 0, sizeof(h->count));
+    for (int i = 0; i < n; i++)
+        h->count[lengths[i]]++;
+
+    if (h->count[0] == n)
+        return 0;
+
+    int left = 1;
+    for (int len = 1; len <= MAX_BITS; len++) {
+        left <<= 1;
+        left -= h->count[len];
+        if (left < 0)
+            return -1;
+    }
+
+    uint16_t offsets[MAX_BITS + 1];
+    offsets[1] = 0;
+    for (int len = 1; len < MAX_BITS; len++)
+        offsets[len + 1] = offsets[len] + h->count[len];
+
+    for (int i = 0; i < n; i++) {
+        if (lengths[i] != 0)
+            h->symbol[offsets[lengths[i]]++] = i;
+    }
+    return left;
+}
+
+static int check_huffman(int rc, const uint8_t *lengths, int n)
+{
+    if (rc <= 0)
+        return rc;
+
+    // Incomplete codes are only allowed when there's just one symbol
+    int used = 0;
+    for (int i = 0; i < n; i++)
+        used += lengths[i] != 0;
+    return used == 1 ? 0 : -1;
+}
+
+static int decode_symbol(struct inflate_state *s, const struct huffman *h)
+{
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (int len = 1; len <= MAX_BITS; len++) {
+        int bit = get_bits(s, 1);
+        if (bit < 0)
+            return -1;
+        code |= bit;
+
+        int count = h->count[len];
+        if (code - count < first)
+            return h->symbol[index + (code - first)];
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+static int inflate_stored(struct inflate_state *s)
+{
+    // Stored blocks start on a byte boundary
+    s->bit_buffer = 0;
+    s->bit_count = 0;
+
+    int len = get_bits(s, 16);
+    int nlen = get_bits(s, 16);
+    if (len < 0 || nlen < 0 || len != (~nlen & 0xffff))
+        return -1;
+
+    while (len--) {
+        int byte = get_byte(s);
+        if (byte < 0 || put_byte(s, byte) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int inflate_codes(struct inflate_state *s, const struct huffman *litlen, const struct huffman *dist)
+{
+    for (;;) {
+        int symbol = decode_symbol(s, litlen);
+        if (symbol < 0)
+            return -1;
+
+        if (symbol < 256) {
+            if (put_byte(s, symbol) < 0)
+                return -1;
+            continue;
+        }
+        if (symbol == 256)
+            return 0;
+
+        symbol -= 257;
+        if (symbol >= 29)
+            return -1;
+        int extra = get_bits(s, length_extra[symbol]);
+        if (extra < 0)
+            return -1;
+        size_t len = length_base[symbol] + extra;
+
+        symbol = decode_symbol(s, dist);
+        if (symbol < 0 || symbol >= 30)
+            return -1;
+        extra = get_bits(s, dist_extra[symbol]);
+        if (extra < 0)
+            return -1;
+        size_t distance = dist_base[symbol] + extra;
+
+        if (distance > s->out_len)
+            return -1;
+
+        // Byte at a time since the source and destination may overlap
+        for (size_t i = 0; i < len; i++) {
+            if (put_byte(s, s->window[(s->out_len - distance) % WINDOW_SIZE]) < 0)
+                return -1;
+        }
+    }
+}
+
+static int inflate_fixed(struct inflate_state *s)
+{
+    uint8_t lengths[MAX_CODES];
+    int i;
+    for (i = 0; i < 144; i++)
+        lengths[i] = 8;
+    for (; i < 256; i++)
+        lengths[i] = 9;
+    for (; i < 280; i++)
+        lengths[i] = 7;
+    for (; i < MAX_LITLEN_CODES; i++)
+        lengths[i] = 8;
+    for (; i < MAX_CODES; i++)
+        lengths[i] = 5;
+
+    struct huffman litlen;
+    struct huffman dist;
+    build_huffman(&litlen, lengths, MAX_LITLEN_CODES);
+    build_huffman(&dist, &lengths[MAX_LITLEN_CODES], MAX_DIST_CODES);
+    return inflate_codes(s, &litlen, &dist);
+}
+
+static int inflate_dynamic(struct inflate_state *s)
+{
+    static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+    int nlitlen = get_bits(s, 5);
+    int ndist = get_bits(s, 5);
+    int ncode = get_bits(s, 4);
+    if (nlitlen < 0 || ndist < 0 || ncode < 0)
+        return -1;
+    nlitlen += 257;
+    ndist += 1;
+    ncode += 4;
+    if (nlitlen > MAX_LITLEN_CODES || ndist > MAX_DIST_CODES)
+        return -1;
+
+    uint8_t lengths[MAX_CODES];
+    memset(lengths, 0, 19);
+    for (int i = 0; i < ncode; i++) {
+        int len = get_bits(s, 3);
+        if (len < 0)
+            return -1;
+        lengths[order[i]] = len;
+    }
+
+    struct huffman litlen;
+    struct huffman dist;
+    if (build_huffman(&litlen, lengths, 19) != 0)
+        return -1;
+
+    int index = 0;
+    while (index < nlitlen + ndist) {
+        int symbol = decode_symbol(s, &litlen);
+        if (symbol < 0)
+            return -1;
+        if (symbol < 16) {
+            lengths[index++] = symbol;
+            continue;
+        }
+
+        int len = 0;
+        int repeat;
+        if (symbol == 16) {
+            if (index == 0)
+                return -1;
+            len = lengths[index - 1];
+            repeat = get_bits(s, 2);
+            repeat = repeat < 0 ? -1 : 3 + repeat;
+        } else if (symbol == 17) {
+            repeat = get_bits(s, 3);
+            repeat = repeat < 0 ? -1 : 3 + repeat;
+        } else {
+            repeat = get_bits(s, 7);
+            repeat = repeat < 0 ? -1 : 11 + repeat;
+        }
+        if (repeat < 0 || index + repeat > nlitlen + ndist)
+            return -1;
+        while (repeat--)
+            lengths[index++] = len;
+    }
+
+    // There has to be a way to end the block
+    if (lengths[256] == 0)
+        return -1;
+
+    if (check_huffman(build_huffman(&litlen, lengths, nlitlen), lengths, nlitlen) < 0 ||
+        check_huffman(build_huffman(&dist, &lengths[nlitlen], ndist), &lengths[nlitlen], ndist) < 0)
+        return -1;
+
+    return inflate_codes(s, &litlen, &dist);
+}
+
+static int inflate_blocks(struct inflate_state *s)
+{
+    int last;
+    do {
+        last = get_bits(s, 1);
+        int type = get_bits(s, 2);
+        if (last < 0 || type < 0)
+            return -1;
+
+        int rc;
+        switch (type) {
+        case 0: rc = inflate_stored(s); break;
+        case 1: rc = inflate_fixed(s); break;
+        case 2: rc = inflate_dynamic(s); break;
+        default: rc = -1; break;
+        }
+        if (rc < 0)
+            return -1;
+    } while (!last);
+
+    return 0;
+}
+
+// Returns 0 and the next little endian 32-bit number in *value
+static int get_le32(struct inflate_state *s, uint32_t *value)
+{
+    *value = 0;
+    for (int i = 0; i < 32; i += 8) {
+        int byte = get_byte(s);
+        if (byte < 0)
+            return -1;
+        *value |= (uint32_t) byte << i;
+    }
+    return 0;
+}
+
+static int skip_bytes(struct inflate_state *s, int count)
+{
+    while (count--) {
+        if (get_byte(s) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int skip_string(struct inflate_state *s)
+{
+    int byte;
+    do {
+        byte = get_byte(s);
+    } while (byte > 0);
+    return byte;
+}
+
+static int skip_gzip_header(struct inflate_state *s)
+{
+    if (get_byte(s) != 0x1f || get_byte(s) != 0x8b || get_byte(s) != 8)
+        ERR_RETURN("Not a gzip file");
+
+    int flags = get_byte(s);
+    if (flags < 0 || skip_bytes(s, 6) < 0)
+        ERR_RETURN("Truncated gzip header");
+    if (flags & GZIP_FEXTRA) {
+        int lo = get_byte(s);
+        int hi = get_byte(s);
+        if (lo < 0 || hi < 0 || skip_bytes(s, lo | (hi << 8)) < 0)
+            ERR_RETURN("Truncated gzip header");
+    }
+    if (((flags & GZIP_FNAME) && skip_string(s) < 0) ||
+        ((flags & GZIP_FCOMMENT) && skip_string(s) < 0) ||
+        ((flags & GZIP_FHCRC) && skip_bytes(s, 2) < 0))
+        ERR_RETURN("Truncated gzip header");
+    return 0;
+}
+
+static int gunzip_fd(struct inflate_state *s)
+{
+    OK_OR_RETURN(skip_gzip_header(s));
+
+    s->crc = 0xffffffff;
+    if (inflate_blocks(s) < 0) {
+        if (s->write_failed)
+            ERR_RETURN("Write failed");
+        ERR_RETURN("Corrupt gzip data");
+    }
+    OK_OR_RETURN_MSG(flush_window(s, s->out_len % WINDOW_SIZE), "Write failed");
+
+    // The trailer starts on the next byte boundary
+    uint32_t expected_crc;
+    uint32_t expected_len;
+    s->bit_count = 0;
+    if (get_le32(s, &expected_crc) < 0 ||
+        get_le32(s, &expected_len) < 0 ||
+        ~s->crc != expected_crc ||
+        (uint32_t) s->out_len != expected_len)
+        ERR_RETURN("gzip CRC or length mismatch");
+
+    return 0;
+}
+
+int gunzip_file(const char *from, const char *to)
+{
+    int rc = 0;
+    char tmp_path[PATH_MAX];
+    struct inflate_state *s = NULL;
+
+    int in_fd = open(from, O_RDONLY | O_CLOEXEC);
+    if (in_fd < 0)
+        ERR_RETURN("Could not open %s", from);
+
+    struct stat st;
+    if (fstat(in_fd, &st) < 0)
+        ERR_CLEANUP_MSG("Could not stat %s", from);
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", to);
+    int out_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777);
+    if (out_fd < 0)
+        ERR_CLEANUP_MSG("Could not create %s", tmp_path);
+
+    s = calloc(1, sizeof(struct inflate_state));
+    if (!s) {
+        close(out_fd);
+        unlink(tmp_path);
+        ERR_CLEANUP_MSG("Out of memory decompressing %s", from);
+    }
+    s->in_fd = in_fd;
+    s->out_fd = out_fd;
+
+    rc = gunzip_fd(s);
+    if (close(out_fd) < 0)
+        rc = -1;
+    if (rc < 0) {
+        unlink(tmp_path);
+        ERR_CLEANUP_MSG("Could not decompress %s", from);
+    }
+
+    OK_OR_CLEANUP_MSG(rename(tmp_path, to), "Could not rename %s to %s", tmp_path, to);
+
+cleanup:
+    free(s);
+    close(in_fd);
+    return rc;
+}
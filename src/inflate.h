@@ -0,0 +1,9 @@
+#ifndef INFLATE_H
+#define INFLATE_H
+
+// Decompress the gzip file at `from` to `to`. `to` gets the permissions of
+// `from` and only appears once it's complete. Only a 32 KiB window and a
+// small input buffer are needed in RAM.
+int gunzip_file(const char *from, const char *to);
+
+#endif // INFLATE_H
@@ -0,0 +1,158 @@
+#include "mtd.h"
+#include "util.h"
+#include "block_device.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <mtd/mtd-user.h>
+
+// Offsets passed to mtd_pread() and mtd_pwrite() are logical like U-Boot's.
+// Bad erase blocks are skipped, so data after a bad block moves down one
+// block. Erase blocks that are partially covered by a write are read,
+// patched and rewritten so that nothing else in them is lost.
+
+bool mtd_is_device(const char *path)
+{
+    // /dev/mtdN, but not /dev/mtdblockN or /dev/mtdNro
+    if (strncmp(path, "/dev/mtd", 8) != 0 || path[8] == '\0')
+        return false;
+
+    for (const char *p = &path[8]; *p != '\0'; p++) {
+        if (!isdigit((unsigned char) *p))
+            return false;
+    }
+    return true;
+}
+
+int mtd_find_by_name(const char *name, char *path)
+{
+    FILE *fp = fopen("/proc/mtd", "r");
+    if (!fp)
+        return -1;
+
+    // Lines look like: mtd1: 00020000 00020000 "u-boot-env"
+    int rc = -1;
+    char line[128];
+    while (fgets(line, sizeof(line), fp)) {
+        int index;
+        char mtd_name[64];
+        if (sscanf(line, "mtd%d: %*x %*x \"%63[^\"]\"", &index, mtd_name) == 2 &&
+            strcmp(mtd_name, name) == 0) {
+            snprintf(path, BLOCK_DEVICE_PATH_LEN, "/dev/mtd%d", index);
+            rc = 0;
+            break;
+        }
+    }
+    fclose(fp);
+    return rc;
+}
+
+static bool is_bad_block(int fd, off_t offset)
+{
+    // NOR flash doesn't support MEMGETBADBLOCK and doesn't have bad blocks.
+    int64_t block_offset = offset;
+    return ioctl(fd, MEMGETBADBLOCK, &block_offset) > 0;
+}
+
+// Call fun for each erase block piece of the logical range. Return the
+// number of bytes handled or -1 on error.
+static ssize_t for_each_block(int fd, size_t count, off_t offset,
+                              int (*fun)(int fd, const struct mtd_info_user *geometry, off_t block, size_t block_offset, size_t len, void *cookie),
+                              void *cookie)
+{
+    struct mtd_info_user geometry;
+    if (ioctl(fd, MEMGETINFO, &geometry) < 0)
+        ERR_RETURN("MEMGETINFO failed. Is this an MTD device?");
+
+    off_t block = offset - offset % geometry.erasesize;
+    size_t block_offset = offset % geometry.erasesize;
+    size_t done = 0;
+    while (done < count) {
+        if (block + geometry.erasesize > geometry.size)
+            ERR_RETURN("Ran out of good erase blocks on MTD device");
+
+        if (is_bad_block(fd, block)) {
+            info("Skipping bad MTD erase block at 0x%08llx", (unsigned long long) block);
+            block += geometry.erasesize;
+            continue;
+        }
+
+        size_t len = geometry.erasesize - block_offset;
+        if (len > count - done)
+            len = count - done;
+
+        if (fun(fd, &geometry, block, block_offset, len, cookie) < 0)
+            return -1;
+
+        done += len;
+        block += geometry.erasesize;
+        block_offset = 0;
+    }
+    return done;
+}
+
+struct mtd_transfer
+{
+    uint8_t *data;
+    char *scratch;
+};
+
+static int read_piece(int fd, const struct mtd_info_user *geometry, off_t block, size_t block_offset, size_t len, void *cookie)
+{
+    (void) geometry;
+    struct mtd_transfer *transfer = cookie;
+    if (pread(fd, transfer->data, len, block + block_offset) != (ssize_t) len)
+        return -1;
+
+    transfer->data += len;
+    return 0;
+}
+
+static int write_piece(int fd, const struct mtd_info_user *geometry, off_t block, size_t block_offset, size_t len, void *cookie)
+{
+    struct mtd_transfer *transfer = cookie;
+
+    // Flash can only be written a page at a time after an erase, so always
+    // write the whole erase block.
+    const char *source = (const char *) transfer->data;
+    if (len != geometry->erasesize) {
+        if (!transfer->scratch)
+            transfer->scratch = malloc(geometry->erasesize);
+        if (pread(fd, transfer->scratch, geometry->erasesize, block) != (ssize_t) geometry->erasesize)
+            ERR_RETURN("Could not read MTD erase block at 0x%08llx", (unsigned long long) block);
+
+        memcpy(transfer->scratch + block_offset, source, len);
+        source = transfer->scratch;
+    }
+
+    struct erase_info_user erase;
+    erase.start = block;
+    erase.length = geometry->erasesize;
+    if (ioctl(fd, MEMERASE, &erase) < 0)
+        ERR_RETURN("Could not erase MTD erase block at 0x%08llx", (unsigned long long) block);
+
+    if (pwrite(fd, source, geometry->erasesize, block) != (ssize_t) geometry->erasesize)
+        ERR_RETURN("Could not write MTD erase block at 0x%08llx", (unsigned long long) block);
+
+    transfer->data += len;
+    return 0;
+}
+
+ssize_t mtd_pread(int fd, void *buf, size_t count, off_t offset)
+{
+    struct mtd_transfer transfer = {buf, NULL};
+    return for_each_block(fd, count, offset, read_piece, &transfer);
+}
+
+ssize_t mtd_pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+    struct mtd_transfer transfer = {(uint8_t *) buf, NULL};
+    ssize_t rc = for_each_block(fd, count, offset, write_piece, &transfer);
+    free(transfer.scratch);
+    return rc;
+}
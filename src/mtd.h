@@ -0,0 +1,13 @@
+#ifndef MTD_H
+#define MTD_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+bool mtd_is_device(const char *path);
+int mtd_find_by_name(const char *name, char *path);
+
+ssize_t mtd_pread(int fd, void *buf, size_t count, off_t offset);
+ssize_t mtd_pwrite(int fd, const void *buf, size_t count, off_t offset);
+
+#endif // MTD_H
@@ -20,6 +20,8 @@
 #include "script.h"
 #include "block_device.h"
 #include "rootdisk.h"
+#include "timeline.h"
+#include "trace.h"
 
 // Global U-Boot environment data
 struct uboot_env working_uboot_env;
@@ -109,12 +111,14 @@ static bool in_skip_list(const char *what, const char **list)
     return false;
 }
 
-void cleanup_dir(int dirfd, const char **skip_list)
+// Returns about how many bytes of RAM were freed
+uint64_t cleanup_dir(int dirfd, const char **skip_list)
 {
+    uint64_t reclaimed = 0;
     DIR *dir = fdopendir(dirfd);
     if (dir == NULL) {
         info("fdopendir failed");
-        return;
+        return 0;
     }
 
     for (struct dirent *dt = readdir(dir); dt != NULL; dt = readdir(dir)) {
@@ -126,17 +130,27 @@ void cleanup_dir(int dirfd, const char **skip_list)
         if (dt->d_type & DT_DIR) {
             int fd = openat(dirfd, name, O_RDONLY);
             if (fd >= 0) {
-                cleanup_dir(fd, nonroot_skip_list);
+                reclaimed += cleanup_dir(fd, nonroot_skip_list);
             } else {
                 info("openat %s failed", name);
             }
             OK_OR_WARN(unlinkat(dirfd, name, AT_REMOVEDIR), "unlinkat directory  %s", name);
         } else {
+            // ramfs doesn't keep track of blocks, so fall back to the size
+            // rounded up to the page size.
+            struct stat st;
+            if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && st.st_nlink == 1) {
+                if (st.st_blocks)
+                    reclaimed += (uint64_t) st.st_blocks * 512;
+                else if (S_ISREG(st.st_mode))
+                    reclaimed += ((uint64_t) st.st_size + 4095) & ~4095ULL;
+            }
             OK_OR_WARN(unlinkat(dirfd, name, 0), "unlinkat %s", name);
         }
     }
 
     closedir(dir);
+    return reclaimed;
 }
 
 static void cleanup_old_rootfs()
@@ -147,25 +161,29 @@ static void cleanup_old_rootfs()
         return;
     }
 
-    cleanup_dir(fd, root_skip_list);
-
-    rmdir("/sys");
-    rmdir("/proc");
+    timeline_value("reclaimed_bytes", cleanup_dir(fd, root_skip_list));
 }
 
 static void switch_root()
 {
     // Thank you busybox for all of the comments on how this is supposed to work.
 
+    // Get tracefs out of the way of unmounting /sys
+    trace_detach();
+
     // Move /dev to its new home
     OK_OR_WARN(mount("/dev", "/mnt/dev", NULL, MS_MOVE, NULL), "moving /dev failed");
 
+    // Clean up the "old" rootfs. /sys and /proc are skipped, so do this
+    // first to let the timeline see what it freed in /proc/meminfo.
+    cleanup_old_rootfs();
+    timeline_sample();
+
     // Unmount /sys and /proc so that the next init can mount them
     OK_OR_WARN(umount("/sys"), "unmounting /sys failed");
     OK_OR_WARN(umount("/proc"), "unmounting /proc failed");
-
-    // Clean up the "old" rootfs.
-    cleanup_old_rootfs();
+    rmdir("/sys");
+    rmdir("/proc");
 
     // Change to the new mount
     OK_OR_DEBUG(chdir("/mnt"), "chdir /mnt failed");
@@ -219,10 +237,12 @@ static void mount_encrypted_fs(const char *rootfs_path, const char *rootfs_type,
 
     off_t rootfs_blocks = rootfs_size / block_size;
 
+    timeline_begin("dm_setup");
     int loop_fd = losetup(rootfs_fd);
     close(rootfs_fd);
 
     dm_create(rootfs_blocks, cipher, secret);
+    timeline_end();
 
     OK_OR_FATAL(mount("/dev/dm-0", "/mnt", rootfs_type, MS_RDONLY, NULL), "Expecting %s filesystem on %s", rootfs_type, rootfs_path);
 
@@ -245,6 +265,40 @@ static void repl()
     }
 }
 
+static void start_tracing()
+{
+    // trace_open() logs why if it fails and there's nothing else to do.
+    if (get_variable_as_boolean("trace.enabled"))
+        (void) trace_open();
+}
+
+static void update_log_level()
+{
+    int level = get_variable_as_number("log.level");
+    if (level < 0)
+        level = 0;
+    else if (level > 7)
+        level = 7;
+    log_set_level(level);
+}
+
+static void update_timeline_sampling()
+{
+    timeline_set_sampling(get_variable_as_boolean("timeline.samples") &&
+                          *get_variable_as_string("timeline.path") != '\0');
+}
+
+static void write_timeline()
+{
+    const char *path = get_variable_as_string("timeline.path");
+    if (*path == '\0')
+        return;
+
+    // The timeline is only informational, so don't make noise if there's
+    // nowhere to put it.
+    OK_OR_DEBUG(timeline_write(path), "Couldn't write timeline to %s", path);
+}
+
 static void initialize_script_defaults(int argc, char *argv[])
 {
     term_gc_heap();
@@ -261,7 +315,38 @@ static void initialize_script_defaults(int argc, char *argv[])
     set_boolean_variable("uboot_env.modified", false);
     set_number_variable("uboot_env.start", 256);
     set_number_variable("uboot_env.count", 256);
-
+    set_boolean_variable("uboot_env.redundant", false);
+    set_number_variable("uboot_env.redundant_start", 512);
+
+    set_string_variable("fwup_revert.fwup", "/usr/bin/fwup");
+    set_string_variable("fwup_revert.fw", "revert.fw");
+
+    set_string_variable("ab_revert.active_var", "nerves_fw_active");
+    set_string_variable("ab_revert.require_var", "nerves_fw_platform");
+    set_string_variable("ab_revert.setenv", "nerves_fw_validated=1");
+
+    set_string_variable("bootstate.path", "");
+    set_number_variable("bootstate.start", 0);
+    set_boolean_variable("bootstate.loaded", false);
+    set_string_variable("bootstate.slot", "");
+    set_number_variable("bootstate.attempts", 0);
+    set_boolean_variable("bootstate.validated", false);
+
+    set_string_variable("bootstats.path", "");
+    set_number_variable("bootstats.start", 0);
+    set_boolean_variable("bootstats.fallback", false);
+
+    set_number_variable("cmd.timeout", 60000);
+    set_number_variable("cmd.nice", 0);
+    set_number_variable("cmd.ioprio_class", 0);
+    set_number_variable("cmd.ioprio_level", 0);
+    set_string_variable("cmd.payloads", "");
+
+    set_number_variable("log.level", log_get_level());
+    set_boolean_variable("profile.enabled", false);
+    set_string_variable("timeline.path", "/dev/nerves_initramfs.timeline");
+    set_boolean_variable("timeline.samples", false);
+    set_boolean_variable("trace.enabled", false);
     set_boolean_variable("run_repl", false);
 
     // Scan the commandline for more parameters to set. Our instructions tell
@@ -299,6 +384,8 @@ static void initialize_script_defaults(int argc, char *argv[])
 
 int main(int argc, char *argv[])
 {
+    timeline_mark("entry");
+
     info("version " PROGRAM_VERSION_STR
 #ifdef DEBUG
          " [DEBUG]"
@@ -308,22 +395,39 @@ int main(int argc, char *argv[])
     if (getpid() != 1)
        fatal("Must be pid 1");
 
+    timeline_begin("setup_initramfs");
     setup_initramfs();
+    timeline_end();
 
     // Initialize scripting environment
     initialize_script_defaults(argc, argv);
 
+    // Tracing can be enabled on the commandline to cover the script or by
+    // the script to cover everything after it.
+    update_log_level();
+    update_timeline_sampling();
+    start_tracing();
+
+    timeline_begin("script");
     eval_file("/nerves_initramfs.conf");
+    timeline_end();
+
+    update_log_level();
+    update_timeline_sampling();
+    start_tracing();
 
     if (get_variable_as_boolean("run_repl"))
         repl();
 
     // Mount the root filesystem
+    timeline_begin("resolve");
     const char *rootfs_spec = get_variable_as_string("rootfs.path");
     char resolved_rootfs_path[BLOCK_DEVICE_PATH_LEN];
     if (resolve_block_device_spec(rootfs_spec, resolved_rootfs_path) < 0)
         fatal("Can't continue since '%s' does not exist.", rootfs_spec);
+    timeline_end();
 
+    timeline_begin("mount");
     const char *rootfs_fstype = get_variable_as_string("rootfs.fstype");
     if (get_variable_as_boolean("rootfs.encrypted"))
         mount_encrypted_fs(resolved_rootfs_path,
@@ -332,12 +436,29 @@ int main(int argc, char *argv[])
                            get_variable_as_string("rootfs.secret"));
     else
         mount_fs(resolved_rootfs_path, rootfs_fstype);
+    timeline_end();
 
     // Finalize our setup of the root filesystem
+    timeline_begin("symlinks");
     create_rootdisk_symlinks(resolved_rootfs_path);
+    timeline_end();
+
+    // The boot statistics device can't be found once /sys and /proc are gone
+    bootstats_open();
 
     // Switch over to the new root filesystem
+    timeline_begin("switch_root");
     switch_root();
+    timeline_end();
+
+    // Summarize where the script spent its time if asked
+    profile_report();
+
+    // Hand off the timeline via the moved /dev so that the next init can
+    // pick it up.
+    timeline_mark("exec");
+    bootstats_record();
+    write_timeline();
 
     // Launch the real init. It's always /sbin/init with Buildroot.
     execv("/sbin/init", argv);
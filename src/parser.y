@@ -2,9 +2,11 @@
 #include <stdio.h>
 #include <strings.h>
 #include "script.h"
+#include "timeline.h"
 
 extern int yylex(void);
 extern int yyerror(const char *s);
+extern int yyget_lineno(void);
 
 const struct term *parser_result;
 
@@ -51,12 +53,16 @@ const struct term *parser_result;
 
 Statements:
   /* empty */  { parser_result = NULL; }
-  | Statements Statement { parser_result = $2; }
+  | Statements Statement { parser_result = $2; timeline_statement_end(); }
   ;
 
 Statement:
-  Rule { $$ = NULL; }
-  | Action { $$ = run_functions($1); }
+  StatementStart Rule { $$ = NULL; }
+  | StatementStart Action { $$ = run_functions($2); }
+  ;
+
+StatementStart:
+  /* empty */ { timeline_statement_begin(yyget_lineno()); }
   ;
 
 Rule:
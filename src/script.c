@@ -2,16 +2,29 @@
 #include "util.h"
 #include "parser.tab.h"
 #include "block_device.h"
+#include "bootstate.h"
+#include "bootstats.h"
+#include "cache.h"
 #include "cmd.h"
+#include "gpt.h"
+#include "inflate.h"
+#include "mtd.h"
+#include "timeline.h"
+#include "trace.h"
 
+#include <ctype.h>
 #include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <regex.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 
 #include <linux/reboot.h>
 #include <sys/reboot.h>
@@ -22,6 +35,10 @@ static char *heap = NULL;
 static int heap_index = 0;
 static struct term *variables = NULL;
 
+// Set through the profile.enabled variable
+static bool profiling = false;
+static void profile_record(fun_handler fun, uint64_t elapsed_ns);
+
 /**
  * This can only be called between parsing statements
  * since we don't track references in bison.
@@ -99,6 +116,22 @@ struct term *term_new_string(const char *value)
     return rv;
 }
 
+static struct term *term_new_string_buffer(size_t len)
+{
+    struct term *rv = alloc_heap(sizeof(struct term));
+    rv->kind = term_string;
+    rv->string = alloc_heap(len + 1);
+    rv->string[len] = '\0';
+    return rv;
+}
+
+static struct term *term_new_substring(const char *value, size_t len)
+{
+    struct term *rv = term_new_string_buffer(len);
+    memcpy(rv->string, value, len);
+    return rv;
+}
+
 struct term *term_new_qstring(const char *value)
 {
     struct term *rv = alloc_heap(sizeof(struct term));
@@ -115,6 +148,20 @@ struct term *term_new_boolean(bool value)
     return rv;
 }
 
+struct term *term_new_binary(const uint8_t *data, size_t length)
+{
+    struct term *rv = alloc_heap(sizeof(struct term));
+    rv->kind = term_binary;
+
+    // The extra '\0' makes binaries holding text safe to use as C strings.
+    rv->binary.data = alloc_heap(length + 1);
+    rv->binary.length = length;
+    if (data)
+        memcpy(rv->binary.data, data, length);
+    rv->binary.data[length] = '\0';
+    return rv;
+}
+
 struct term *term_new_identifier(const char *value)
 {
     struct term *rv = alloc_heap(sizeof(struct term));
@@ -166,6 +213,8 @@ struct term *term_dupe(const struct term *rv)
         return term_new_number(rv->number);
     case term_boolean:
         return term_new_boolean(rv->boolean);
+    case term_binary:
+        return term_new_binary(rv->binary.data, rv->binary.length);
     default:
         // Not supported
         return NULL;
@@ -187,6 +236,12 @@ void inspect(const struct term *rv)
     case term_boolean:
         fprintf(stderr, "%s", rv->boolean ? "true" : "false");
         break;
+    case term_binary:
+        fprintf(stderr, "<<");
+        for (size_t i = 0; i < rv->binary.length; i++)
+            fprintf(stderr, "%s%d", i ? "," : "", rv->binary.data[i]);
+        fprintf(stderr, ">>");
+        break;
     case term_fun: {
         const struct term *p = rv->fun.parameters;
         const struct function_info *fun_info = function_info_by_fun(rv->fun.fun);
@@ -210,14 +265,29 @@ void inspect(const struct term *rv)
     }
 }
 
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 static const struct term *run_function(const struct term *rv)
 {
     assert(rv->kind == term_fun);
 
-    if (rv->fun.fun)
-        return rv->fun.fun(rv->fun.parameters);
-    else
+    if (!rv->fun.fun)
         return term_new_boolean(false);
+
+    if (!profiling)
+        return rv->fun.fun(rv->fun.parameters);
+
+    // Times include evaluating the parameters, so nested calls are counted
+    // in both the caller and the callee.
+    uint64_t start = now_ns();
+    const struct term *result = rv->fun.fun(rv->fun.parameters);
+    profile_record(rv->fun.fun, now_ns() - start);
+    return result;
 }
 
 const struct term *run_functions(const struct term *rv)
@@ -255,6 +325,20 @@ int term_compare(const struct term *left, const struct term *right)
     const struct term *rleft = term_resolve(left);
     const struct term *rright = term_resolve(right);
 
+    // Binaries compare bytewise against binaries and strings
+    if (rleft->kind == term_binary || rright->kind == term_binary) {
+        const struct term *l = rleft->kind == term_binary ? rleft : term_to_string(rleft);
+        const struct term *r = rright->kind == term_binary ? rright : term_to_string(rright);
+        size_t llen = l->kind == term_binary ? l->binary.length : strlen(l->string);
+        size_t rlen = r->kind == term_binary ? r->binary.length : strlen(r->string);
+        const void *ldata = l->kind == term_binary ? (const void *) l->binary.data : l->string;
+        const void *rdata = r->kind == term_binary ? (const void *) r->binary.data : r->string;
+        int rc = memcmp(ldata, rdata, llen < rlen ? llen : rlen);
+        if (rc != 0)
+            return rc;
+        return (llen > rlen) - (llen < rlen);
+    }
+
     // Make them the same...
 
 
@@ -288,6 +372,8 @@ bool term_to_boolean(const struct term *rv)
         return rv->number != 0;
     case term_boolean:
         return rv->boolean;
+    case term_binary:
+        return rv->binary.length > 0;
     default:
         return false;
     }
@@ -303,6 +389,8 @@ int term_to_number(const struct term *rv)
         return rv->number;
     case term_boolean:
         return rv->boolean ? 1 : 0;
+    case term_binary:
+        return strtoull((const char *) rv->binary.data, NULL, 0);
     default:
         return 0;
     }
@@ -324,6 +412,9 @@ const struct term *term_to_string(const struct term *rv)
     }
     case term_boolean:
         return term_new_string(rv->boolean ? "true" : "false");
+    case term_binary:
+        // Binaries holding text convert naturally. Use hex_encode/1 for the rest.
+        return term_new_string((const char *) rv->binary.data);
     default:
         return term_new_string("");
     }
@@ -386,6 +477,10 @@ void set_variable(const char *name, const struct term *value)
         rv->next = variables;
         variables = rv;
     }
+
+    // Checked here so that run_function doesn't need a variable lookup.
+    if (strcmp(name, "profile.enabled") == 0)
+        profiling = term_to_boolean(value);
 }
 
 void set_string_variable(const char *name, const char *value)
@@ -453,20 +548,70 @@ static const struct term *function_env(const struct term *parameters)
 {
     (void)parameters;
 
-    for (const struct uboot_name_value *var = working_uboot_env.vars; var; var = var->next) {
+    for (size_t i = 0; i < working_uboot_env.count; i++) {
+        const struct uboot_name_value *var = working_uboot_env.vars[i];
         fprintf(stderr, "%s=%s\n", var->name, var->value);
     }
 
     return NULL;
 }
-static const struct term *function_loadenv(const struct term *parameters)
+// What's on disk for each copy of the U-Boot environment as of the last
+// loadenv() or saveenv(). saveenv() compares against these so that it only
+// writes the sectors that changed.
+struct uboot_env_image
+{
+    char devpath[BLOCK_DEVICE_PATH_LEN];
+    int block;
+    size_t size;
+    char *data;
+};
+
+static struct uboot_env_image env_images[2];
+
+static void remember_env_image(int copy, const char *devpath, int block, const char *data, size_t size)
+{
+    struct uboot_env_image *image = &env_images[copy];
+    if (image->size != size)
+        image->data = realloc(image->data, size);
+
+    strcpy(image->devpath, devpath);
+    image->block = block;
+    image->size = size;
+    memcpy(image->data, data, size);
+}
+
+static const char *find_env_image(const char *devpath, int block, size_t size)
+{
+    for (size_t i = 0; i < sizeof(env_images) / sizeof(env_images[0]); i++) {
+        const struct uboot_env_image *image = &env_images[i];
+        if (image->data && image->block == block && image->size == size && strcmp(image->devpath, devpath) == 0)
+            return image->data;
+    }
+    return NULL;
+}
+
+static int read_env_blocks(int fd, int block, int block_count, char *buffer, const char *devpath)
+{
+    ssize_t amount_read;
+    if (mtd_is_device(devpath))
+        amount_read = mtd_pread(fd, buffer, block_count * 512, (off_t) block * 512);
+    else
+        amount_read = pread(fd, buffer, block_count * 512, (off_t) block * 512);
+    if (amount_read != (ssize_t) block_count * 512) {
+        info("Could not read %d blocks (%d bytes) at block %d from '%s'", block_count, block_count * 512, block, devpath);
+        return -1;
+    }
+    return 0;
+}
+static const struct term *loadenv(void)
 {
-    (void)parameters;
     const char *devpathspec = get_variable_as_string("uboot_env.path");
     char devpath[BLOCK_DEVICE_PATH_LEN];
 
     int block = get_variable_as_number("uboot_env.start");
     int block_count = get_variable_as_number("uboot_env.count");
+    bool redundant = get_variable_as_boolean("uboot_env.redundant");
+    int redundant_block = get_variable_as_number("uboot_env.redundant_start");
 
     working_uboot_env.env_size = block_count * 512;
     int fd = open_block_device(devpathspec, O_RDONLY, devpath);
@@ -474,34 +619,63 @@ static const struct term *function_loadenv(const struct term *parameters)
         info("Could not open '%s'", devpathspec);
         return NULL;
     }
-    if (lseek(fd, block * 512, SEEK_SET) < 0) {
-        info("Could not seek to block %d (byte offset %d) in '%s'", block, block * 512, devpath);
-        close(fd);
-        return NULL;
+
+    // Read both copies of a redundant environment with one I/O when they're
+    // next to each other, which is the usual layout.
+    char *buffer = malloc(redundant ? 2 * working_uboot_env.env_size : working_uboot_env.env_size);
+    char *copy0 = buffer;
+    char *copy1 = buffer + working_uboot_env.env_size;
+    int rc;
+    if (!redundant) {
+        rc = read_env_blocks(fd, block, block_count, buffer, devpath);
+    } else if (redundant_block == block + block_count) {
+        rc = read_env_blocks(fd, block, 2 * block_count, buffer, devpath);
+    } else if (redundant_block + block_count == block) {
+        rc = read_env_blocks(fd, redundant_block, 2 * block_count, buffer, devpath);
+        copy0 = buffer + working_uboot_env.env_size;
+        copy1 = buffer;
+    } else {
+        rc = read_env_blocks(fd, block, block_count, copy0, devpath);
+        if (rc == 0)
+            rc = read_env_blocks(fd, redundant_block, block_count, copy1, devpath);
     }
-    char *buffer = malloc(working_uboot_env.env_size);
-    ssize_t amount_read = read(fd, buffer, working_uboot_env.env_size);
     close(fd);
 
-    if (amount_read != (ssize_t) working_uboot_env.env_size) {
+    if (rc < 0) {
         free(buffer);
-        info("Could not read %d blocks (%d bytes) from '%s'", block_count, working_uboot_env.env_size, devpath);
         return NULL;
     }
 
+    remember_env_image(0, devpath, block, copy0, working_uboot_env.env_size);
+    if (redundant)
+        remember_env_image(1, devpath, redundant_block, copy1, working_uboot_env.env_size);
+
     set_boolean_variable("uboot_env.loaded", false);
     set_boolean_variable("uboot_env.modified", false);
 
-    if (uboot_env_read(&working_uboot_env, buffer) < 0) {
-        free(buffer);
-        return NULL;
-    }
+    if (redundant)
+        rc = uboot_env_read_redundant(&working_uboot_env, copy0, copy1);
+    else
+        rc = uboot_env_read(&working_uboot_env, buffer);
     free(buffer);
+    if (rc < 0)
+        return NULL;
 
     set_boolean_variable("uboot_env.loaded", true);
 
     return NULL;
 }
+static const struct term *function_loadenv(const struct term *parameters)
+{
+    (void)parameters;
+
+    // The U-Boot environment and fwup are usually the main storage accesses
+    // made by the script, so time them separately.
+    timeline_begin("loadenv");
+    const struct term *result = loadenv();
+    timeline_end();
+    return result;
+}
 static const struct term *function_setenv(const struct term *parameters)
 {
     const char *name = term_to_string(parameters)->string;
@@ -519,54 +693,356 @@ static const struct term *function_getenv(const struct term *parameters)
 {
     const char *name = term_to_string(parameters)->string;
 
-    char *value;
-    if (uboot_env_getenv(&working_uboot_env, name, &value) < 0) {
+    const char *value;
+    if (uboot_env_getenv(&working_uboot_env, name, &value) < 0)
         return term_new_string("");
-    } else {
-        struct term *ret = term_new_string(value);
-        free(value);
-        return ret;
+    else
+        return term_new_string(value);
+}
+static bool env_image_unchanged(const char *buffer, const char *image, size_t size, bool redundant)
+{
+    // The flags byte of a redundant environment changes on every save, but
+    // the CRC doesn't cover it, so everything else can be compared.
+    if (redundant)
+        return memcmp(buffer, image, 4) == 0 && memcmp(buffer + 5, image + 5, size - 5) == 0;
+    else
+        return memcmp(buffer, image, size) == 0;
+}
+static int write_env_blocks(int fd, int block, const char *buffer, const char *old, size_t size, const char *devpath)
+{
+    // MTD devices are erased a block at a time so there's no point in
+    // looking for changed sectors.
+    if (mtd_is_device(devpath))
+        return mtd_pwrite(fd, buffer, size, (off_t) block * 512) == (ssize_t) size ? 0 : -1;
+
+    // Write each run of changed sectors with one pwrite. Without an old
+    // image, that's everything.
+    size_t offset = 0;
+    while (offset < size) {
+        if (old && memcmp(buffer + offset, old + offset, 512) == 0) {
+            offset += 512;
+            continue;
+        }
+
+        size_t end = offset + 512;
+        while (end < size && (!old || memcmp(buffer + end, old + end, 512) != 0))
+            end += 512;
+
+        ssize_t amount_written = pwrite(fd, buffer + offset, end - offset, (off_t) block * 512 + offset);
+        if (amount_written != (ssize_t) (end - offset))
+            return -1;
+
+        offset = end;
     }
+
+    return fdatasync(fd);
 }
-static const struct term *function_saveenv(const struct term *parameters)
+static const struct term *saveenv(void)
 {
-    (void)parameters;
 
     const char *devpathspec = get_variable_as_string("uboot_env.path");
     char devpath[BLOCK_DEVICE_PATH_LEN];
 
     int block = get_variable_as_number("uboot_env.start");
     int block_count = get_variable_as_number("uboot_env.count");
+    int redundant_block = get_variable_as_number("uboot_env.redundant_start");
+
+    // Redundant environments are updated by writing the copy that wasn't
+    // loaded. The old copy stays valid in case the write is interrupted.
+    working_uboot_env.redundant = get_variable_as_boolean("uboot_env.redundant");
+    int active_block = block;
+    int copy = 0;
+    if (working_uboot_env.redundant) {
+        if (working_uboot_env.active == 0) {
+            block = redundant_block;
+            copy = 1;
+        } else {
+            active_block = redundant_block;
+        }
+    }
 
+    // Read access is needed to preserve the rest of partially written MTD
+    // erase blocks.
     working_uboot_env.env_size = block_count * 512;
-    int fd = open_block_device(devpathspec, O_WRONLY, devpath);
+    int fd = open_block_device(devpathspec, O_RDWR, devpath);
     if (fd < 0) {
         info("Could not open '%s'", devpathspec);
         return NULL;
     }
-    if (lseek(fd, block * 512, SEEK_SET) < 0) {
-        info("Could not seek to block %d (byte offset %d) in '%s'", block, block * 512, devpath);
+    char *buffer = malloc(working_uboot_env.env_size);
+    if (uboot_env_write(&working_uboot_env, buffer) < 0) {
+        free(buffer);
         close(fd);
         return NULL;
     }
-    char *buffer = malloc(working_uboot_env.env_size);
-    if (uboot_env_write(&working_uboot_env, buffer) < 0) {
+
+    const char *active = find_env_image(devpath, active_block, working_uboot_env.env_size);
+    if (active && env_image_unchanged(buffer, active, working_uboot_env.env_size, working_uboot_env.redundant)) {
+        // Nothing to do
+        close(fd);
         free(buffer);
+        set_boolean_variable("uboot_env.modified", false);
         return NULL;
     }
 
-    ssize_t amount_written = write(fd, buffer, working_uboot_env.env_size);
+    const char *old = find_env_image(devpath, block, working_uboot_env.env_size);
+    int rc = write_env_blocks(fd, block, buffer, old, working_uboot_env.env_size, devpath);
     close(fd);
-    free(buffer);
 
-    if (amount_written != (ssize_t) working_uboot_env.env_size) {
-        info("Could not write %d blocks (%d bytes) from '%s'", block_count, working_uboot_env.env_size, devpath);
+    if (rc < 0) {
+        info("Could not write %d blocks (%d bytes) to '%s'", block_count, working_uboot_env.env_size, devpath);
+        free(env_images[copy].data);
+        memset(&env_images[copy], 0, sizeof(env_images[copy]));
+        free(buffer);
         return NULL;
     }
 
+    remember_env_image(copy, devpath, block, buffer, working_uboot_env.env_size);
+    free(buffer);
+
+    if (working_uboot_env.redundant) {
+        working_uboot_env.active = !working_uboot_env.active;
+        working_uboot_env.flags++;
+    }
+
     set_boolean_variable("uboot_env.modified", false);
     return NULL;
 }
+static const struct term *function_saveenv(const struct term *parameters)
+{
+    (void)parameters;
+
+    timeline_begin("saveenv");
+    const struct term *result = saveenv();
+    timeline_end();
+
+    // Cached commands and files may have read the old environment
+    cache_clear();
+    return result;
+}
+static int open_bootstate(int flags, char *devpath)
+{
+    const char *devpathspec = get_variable_as_string("bootstate.path");
+    if (*devpathspec == '\0') {
+        info("Set bootstate.path to use the boot state");
+        return -1;
+    }
+
+    int fd = open_block_device(devpathspec, flags, devpath);
+    if (fd < 0)
+        info("Could not open '%s'", devpathspec);
+    return fd;
+}
+static int read_bootstate_region(int fd, int block, uint8_t *region, const char *devpath)
+{
+    // The whole ring is read at once. It's only 4 KiB.
+    ssize_t amount_read = pread(fd, region, BOOTSTATE_REGION_SIZE, (off_t) block * 512);
+    if (amount_read != BOOTSTATE_REGION_SIZE) {
+        info("Could not read boot state at block %d from '%s'", block, devpath);
+        return -1;
+    }
+    return 0;
+}
+static const struct term *function_bootstate_load(const struct term *parameters)
+{
+    (void)parameters;
+    char devpath[BLOCK_DEVICE_PATH_LEN];
+    int block = get_variable_as_number("bootstate.start");
+
+    set_boolean_variable("bootstate.loaded", false);
+
+    int fd = open_bootstate(O_RDONLY, devpath);
+    if (fd < 0)
+        return term_new_boolean(false);
+
+    uint8_t region[BOOTSTATE_REGION_SIZE];
+    int rc = read_bootstate_region(fd, block, region, devpath);
+    close(fd);
+    if (rc < 0)
+        return term_new_boolean(false);
+
+    struct bootstate state;
+    if (bootstate_decode(region, &state) < 0) {
+        info("No boot state found in '%s'", devpath);
+        return term_new_boolean(false);
+    }
+
+    set_string_variable("bootstate.slot", state.slot);
+    set_number_variable("bootstate.attempts", state.attempts);
+    set_boolean_variable("bootstate.validated", state.validated);
+    set_boolean_variable("bootstate.loaded", true);
+    return term_new_boolean(true);
+}
+static const struct term *function_bootstate_save(const struct term *parameters)
+{
+    (void)parameters;
+    char devpath[BLOCK_DEVICE_PATH_LEN];
+    int block = get_variable_as_number("bootstate.start");
+
+    int fd = open_bootstate(O_RDWR, devpath);
+    if (fd < 0)
+        return term_new_boolean(false);
+
+    // The new record has to be newer than everything in the ring even if
+    // bootstate_load() wasn't called, so find the newest one first. An empty
+    // ring starts at 1.
+    uint8_t region[BOOTSTATE_REGION_SIZE];
+    if (read_bootstate_region(fd, block, region, devpath) < 0) {
+        close(fd);
+        return term_new_boolean(false);
+    }
+
+    struct bootstate state;
+    if (bootstate_decode(region, &state) < 0)
+        state.seq = 0;
+    state.seq++;
+
+    const char *slot = get_variable_as_string("bootstate.slot");
+    size_t slot_len = strnlen(slot, BOOTSTATE_SLOT_LEN - 1);
+    memcpy(state.slot, slot, slot_len);
+    state.slot[slot_len] = '\0';
+    state.attempts = get_variable_as_number("bootstate.attempts");
+    state.validated = get_variable_as_boolean("bootstate.validated");
+
+    uint8_t record[BOOTSTATE_RECORD_SIZE];
+    bootstate_encode(&state, record);
+
+    off_t offset = (off_t) block * 512 + bootstate_record_index(&state) * BOOTSTATE_RECORD_SIZE;
+    ssize_t amount_written = pwrite(fd, record, sizeof(record), offset);
+    int rc = fdatasync(fd);
+    close(fd);
+    if (amount_written != sizeof(record) || rc < 0) {
+        info("Could not write boot state to '%s'", devpath);
+        return term_new_boolean(false);
+    }
+
+    cache_clear();
+    return term_new_boolean(true);
+}
+static int read_bootstats(struct bootstats *stats, int flags, int *fd_out)
+{
+    const char *devpathspec = get_variable_as_string("bootstats.path");
+    int block = get_variable_as_number("bootstats.start");
+    char devpath[BLOCK_DEVICE_PATH_LEN];
+
+    int fd = open_block_device(devpathspec, flags, devpath);
+    if (fd < 0)
+        ERR_RETURN("Could not open '%s'", devpathspec);
+
+    uint8_t sector[BOOTSTATS_SIZE];
+    if (pread(fd, sector, sizeof(sector), (off_t) block * 512) != sizeof(sector)) {
+        close(fd);
+        ERR_RETURN("Could not read boot statistics at block %d from '%s'", block, devpath);
+    }
+
+    // Start over if the sector has never been written or was corrupted
+    (void) bootstats_decode(sector, stats);
+
+    if (fd_out)
+        *fd_out = fd;
+    else
+        close(fd);
+    return 0;
+}
+
+// Opened by bootstats_open() and written by bootstats_record()
+static int bootstats_fd = -1;
+static struct bootstats pending_bootstats;
+
+void bootstats_open()
+{
+    // PARTUUID= and other specs are resolved with /sys and /proc, so this has
+    // to run before switch_root unmounts them.
+    if (bootstats_fd >= 0 || *get_variable_as_string("bootstats.path") == '\0')
+        return;
+
+    if (read_bootstats(&pending_bootstats, O_RDWR, &bootstats_fd) < 0)
+        bootstats_fd = -1;
+}
+
+void bootstats_record()
+{
+    // Reverts record the boot without going through switch_root
+    bootstats_open();
+    if (bootstats_fd < 0)
+        return;
+
+    struct bootstats stats = pending_bootstats;
+    int fd = bootstats_fd;
+    bootstats_fd = -1;
+
+    struct bootstats_entry entry;
+    memset(&entry, 0, sizeof(entry));
+    const char *slowest_name;
+    uint64_t slowest_ns;
+    entry.total_us = timeline_summary(&slowest_name, &slowest_ns) / 1000;
+    entry.slowest_us = slowest_ns / 1000;
+    memcpy(entry.slowest_phase, slowest_name, strnlen(slowest_name, sizeof(entry.slowest_phase) - 1));
+    entry.fallback = get_variable_as_boolean("bootstats.fallback");
+    bootstats_add(&stats, &entry);
+
+    uint8_t sector[BOOTSTATS_SIZE];
+    bootstats_encode(&stats, sector);
+    off_t offset = (off_t) get_variable_as_number("bootstats.start") * 512;
+    if (pwrite(fd, sector, sizeof(sector), offset) != sizeof(sector) || fdatasync(fd) < 0)
+        info("Could not write boot statistics");
+    close(fd);
+}
+static const struct term *function_bootstats(const struct term *parameters)
+{
+    (void)parameters;
+
+    if (*get_variable_as_string("bootstats.path") == '\0') {
+        info("Set bootstats.path to record boot statistics");
+        return NULL;
+    }
+
+    struct bootstats stats;
+    if (read_bootstats(&stats, O_RDONLY, NULL) < 0)
+        return NULL;
+    if (stats.count == 0) {
+        fprintf(stderr, "No boots recorded\n");
+        return NULL;
+    }
+
+    uint32_t totals[BOOTSTATS_MAX_ENTRIES];
+    uint32_t slowest[BOOTSTATS_MAX_ENTRIES];
+    int fallbacks = 0;
+    for (uint32_t i = 0; i < stats.count; i++) {
+        totals[i] = stats.entries[i].total_us / 1000;
+        slowest[i] = stats.entries[i].slowest_us / 1000;
+        fallbacks += stats.entries[i].fallback;
+    }
+
+    fprintf(stderr, "%u boots, %d with a fallback\n", stats.count, fallbacks);
+    fprintf(stderr, "total_ms: p50=%u p95=%u max=%u\n",
+            bootstats_percentile(totals, stats.count, 50),
+            bootstats_percentile(totals, stats.count, 95),
+            bootstats_percentile(totals, stats.count, 100));
+    fprintf(stderr, "slowest_phase_ms: p50=%u p95=%u max=%u\n",
+            bootstats_percentile(slowest, stats.count, 50),
+            bootstats_percentile(slowest, stats.count, 95),
+            bootstats_percentile(slowest, stats.count, 100));
+
+    // List how often each phase was the slowest one in the order they
+    // first show up.
+    fprintf(stderr, "slowest phases:");
+    for (uint32_t i = 0; i < stats.count; i++) {
+        const char *name = stats.entries[i].slowest_phase;
+        uint32_t j;
+        for (j = 0; j < i && strcmp(stats.entries[j].slowest_phase, name) != 0; j++)
+            ;
+        if (j < i)
+            continue;
+
+        int times = 0;
+        for (j = i; j < stats.count; j++)
+            times += strcmp(stats.entries[j].slowest_phase, name) == 0;
+        fprintf(stderr, " %s=%d", name, times);
+    }
+    fprintf(stderr, "\n");
+    return NULL;
+}
 static const struct term *function_blkid(const struct term *parameters)
 {
     (void)parameters;
@@ -584,34 +1060,211 @@ static const struct term *function_blkid(const struct term *parameters)
     free_block_devices(devices);
     return NULL;
 }
-static const struct term *function_cmd(const struct term *parameters)
+// Maximum amount of a command's output that's kept. The rest is discarded.
+#define CMD_MAX_OUTPUT (HEAP_SIZE / 4)
+
+#define MAX_CMD_ARGS 15
+#define MAX_SPAWNED 8
+
+struct spawned_cmd
+{
+    struct cmd_process process;
+    char *argv0;
+};
+
+static struct spawned_cmd spawned[MAX_SPAWNED];
+
+static void get_cmd_options(struct cmd_options *options)
+{
+    options->timeout_ms = get_variable_as_number("cmd.timeout");
+    options->nice = get_variable_as_number("cmd.nice");
+    options->ioprio_class = get_variable_as_number("cmd.ioprio_class");
+    options->ioprio_level = get_variable_as_number("cmd.ioprio_level");
+}
+
+static int get_cmd_argv(const struct term *parameters, char **argv)
 {
-    const int max_args = 15;
-    char *argv[max_args + 1];
     int index = 0;
-    while (parameters && index < max_args) {
+    while (parameters && index < MAX_CMD_ARGS) {
         const struct term *str = term_to_string(parameters);
         argv[index] = str->string;
         parameters = parameters->next;
         index++;
     }
     argv[index] = 0;
+    return index;
+}
 
-    char output_buffer[256];
-    output_buffer[0] = '\0';
-    if (system_cmd(argv, output_buffer, sizeof(output_buffer)) != 0)
-        info("Ignoring non-zero exit from %s", argv[0]);
+// Large programs and files like fwup and revert.fw can be shipped as
+// "<path>.gz" so that they don't take up RAM uncompressed on every boot.
+// They're unpacked the first time something needs them.
+static void unpack_payload(const char *path)
+{
+    // init runs from "/", so that's what relative paths are relative to
+    char full_path[PATH_MAX];
+    snprintf(full_path, sizeof(full_path), "%s%s", path[0] == '/' ? "" : "/", path);
+
+    struct stat st;
+    if (stat(full_path, &st) == 0)
+        return;
+
+    char gz_path[PATH_MAX + 3];
+    snprintf(gz_path, sizeof(gz_path), "%s.gz", full_path);
+    if (stat(gz_path, &st) < 0)
+        return;
+
+    // Only one copy is needed in RAM after this
+    if (gunzip_file(gz_path, full_path) == 0)
+        unlink(gz_path);
+}
+
+// Only programs listed in cmd.payloads are looked for as "<path>.gz" so
+// that other commands don't pay for the extra stat() calls.
+static void unpack_cmd_payload(const char *path)
+{
+    const char *p = get_variable_as_string("cmd.payloads");
+    size_t path_len = strlen(path);
+
+    for (;;) {
+        p += strspn(p, " ");
+        if (*p == '\0')
+            return;
+
+        size_t len = strcspn(p, " ");
+        if (len == path_len && strncmp(p, path, len) == 0) {
+            unpack_payload(path);
+            return;
+        }
+        p += len;
+    }
+}
+
+static const struct term *finish_cmd(const char *argv0, struct cmd_process *process, int *status)
+{
+    char *output;
+    *status = cmd_join(process, &output, CMD_MAX_OUTPUT);
+    if (process->timed_out)
+        info("Timed out waiting for %s", argv0);
+    else if (*status != 0)
+        info("Ignoring non-zero exit from %s", argv0);
+
+    if (!output)
+        return term_new_string("");
 
     // Trim the output before returning since that's what's expected
     // in practice. There's usually a newline to trim anyway.
-    trim_string_in_place(output_buffer);
+    trim_string_in_place(output);
 
-    return term_new_string(output_buffer);
+    struct term *result = term_new_string(output);
+    free(output);
+    return result;
 }
-static const struct term *function_fwup_revert(const struct term *parameters)
+
+static const struct term *run_cmd(const struct term *parameters, bool cached)
 {
-    (void)parameters;
+    char *argv[MAX_CMD_ARGS + 1];
+    int argc = get_cmd_argv(parameters, argv);
+
+    // The cache key is the resolved argv with each argument '\0' terminated.
+    // The leading 'c' keeps it from colliding with readfile_cached/1 keys.
+    char key[512];
+    size_t key_len = 0;
+    if (cached) {
+        key[key_len++] = 'c';
+        for (int i = 0; i < argc && cached; i++) {
+            size_t len = strlen(argv[i]) + 1;
+            if (key_len + len > sizeof(key))
+                cached = false;
+            else {
+                memcpy(&key[key_len], argv[i], len);
+                key_len += len;
+            }
+        }
+        if (cached) {
+            const char *value = cache_lookup(key, key_len);
+            if (value)
+                return term_new_string(value);
+        }
+    }
+
+    unpack_cmd_payload(argv[0]);
 
+    struct cmd_options options;
+    get_cmd_options(&options);
+
+    trace_begin(argv[0]);
+
+    struct cmd_process process;
+    if (cmd_spawn(argv, &options, &process) < 0) {
+        trace_end();
+        return term_new_string("");
+    }
+
+    int status;
+    const struct term *result = finish_cmd(argv[0], &process, &status);
+    trace_end();
+
+    // Only remember successful runs so that transient failures get retried.
+    if (cached && status == 0)
+        cache_store(key, key_len, result->string);
+
+    return result;
+}
+static const struct term *function_cmd(const struct term *parameters)
+{
+    return run_cmd(parameters, false);
+}
+static const struct term *function_cmd_cached(const struct term *parameters)
+{
+    return run_cmd(parameters, true);
+}
+static const struct term *function_spawn(const struct term *parameters)
+{
+    int handle;
+    for (handle = 0; handle < MAX_SPAWNED; handle++) {
+        if (!spawned[handle].argv0)
+            break;
+    }
+    if (handle == MAX_SPAWNED) {
+        info("Too many spawned commands. Call join/1 first");
+        return term_new_number(0);
+    }
+
+    char *argv[MAX_CMD_ARGS + 1];
+    get_cmd_argv(parameters, argv);
+    unpack_cmd_payload(argv[0]);
+
+    struct cmd_options options;
+    get_cmd_options(&options);
+
+    if (cmd_spawn(argv, &options, &spawned[handle].process) < 0)
+        return term_new_number(0);
+
+    // argv lives on the script heap which may be collected before join/1.
+    spawned[handle].argv0 = strdup(argv[0]);
+    trace_async_begin(argv[0], handle + 1);
+
+    // Handles start at 1 so that 0 can mean failure
+    return term_new_number(handle + 1);
+}
+static const struct term *function_join(const struct term *parameters)
+{
+    int handle = term_to_number(parameters) - 1;
+    if (handle < 0 || handle >= MAX_SPAWNED || !spawned[handle].argv0) {
+        info("join/1 called with an invalid handle");
+        return term_new_string("");
+    }
+
+    int status;
+    const struct term *result = finish_cmd(spawned[handle].argv0, &spawned[handle].process, &status);
+    trace_async_end(spawned[handle].argv0, handle + 1);
+
+    free(spawned[handle].argv0);
+    spawned[handle].argv0 = NULL;
+    return result;
+}
+static const struct term *fwup_revert(void)
+{
     const char *devpathspec = get_variable_as_string("uboot_env.path");
     char devpath[BLOCK_DEVICE_PATH_LEN];
     if (resolve_block_device_spec(devpathspec, devpath) < 0) {
@@ -619,19 +1272,229 @@ static const struct term *function_fwup_revert(const struct term *parameters)
         return term_new_boolean(false);
     }
 
-    char *const argv[7] = {"/usr/bin/fwup", "revert.fw", "-d", devpath, "-t", "revert", 0};
+    char *fwup = (char *) get_variable_as_string("fwup_revert.fwup");
+    char *fw = (char *) get_variable_as_string("fwup_revert.fw");
+    unpack_payload(fwup);
+    unpack_payload(fw);
+
+    char *const argv[7] = {fwup, fw, "-d", devpath, "-t", "revert", 0};
+
+    // fwup gets the same timeout and priorities as cmd() so that a hung
+    // revert can't stall the boot forever
+    struct cmd_options options;
+    get_cmd_options(&options);
 
     char output_buffer[256];
     output_buffer[0] = '\0';
-    if (system_cmd(argv, output_buffer, sizeof(output_buffer)) != 0) {
+    if (system_cmd(argv, &options, output_buffer, sizeof(output_buffer)) != 0) {
         info("Failure from fwup revert: %s", output_buffer);
         return term_new_boolean(false);
     }
 
+    set_boolean_variable("bootstats.fallback", true);
+    bootstats_record();
 
     reboot(LINUX_REBOOT_CMD_RESTART);
     exit(EXIT_FAILURE);
 }
+static const struct term *function_fwup_revert(const struct term *parameters)
+{
+    (void)parameters;
+
+    timeline_begin("fwup_revert");
+    const struct term *result = fwup_revert();
+    timeline_end();
+    return result;
+}
+static const char *ab_revert_getenv(const char *name)
+{
+    const char *value;
+    if (uboot_env_getenv(&working_uboot_env, name, &value) < 0)
+        return "";
+    return value;
+}
+// The list is space separated name=value pairs. Set apply to false to only
+// check them.
+static int ab_revert_setenv_list(const char *list, bool apply)
+{
+    char *copy = strdup(list);
+    char *saveptr;
+    int rc = 0;
+    for (char *pair = strtok_r(copy, " ", &saveptr); pair; pair = strtok_r(NULL, " ", &saveptr)) {
+        char *equals = strchr(pair, '=');
+        if (!equals) {
+            info("Invalid ab_revert.setenv entry '%s'", pair);
+            rc = -1;
+            break;
+        }
+        *equals = '\0';
+        if (!uboot_env_name_valid(pair)) {
+            info("Invalid ab_revert.setenv entry '%s=%s'", pair, equals + 1);
+            rc = -1;
+            break;
+        }
+        if (apply && uboot_env_setenv(&working_uboot_env, pair, equals + 1) < 0) {
+            rc = -1;
+            break;
+        }
+    }
+    free(copy);
+    return rc;
+}
+static const struct term *function_ab_revert(const struct term *parameters)
+{
+    (void)parameters;
+
+    if (!get_variable_as_boolean("uboot_env.loaded")) {
+        function_loadenv(NULL);
+        if (!get_variable_as_boolean("uboot_env.loaded")) {
+            info("Failure to revert since the U-Boot environment couldn't be loaded");
+            return term_new_boolean(false);
+        }
+    }
+
+    // This does the same environment updates as the revert task in the
+    // official Nerves fwup.conf files.
+    const char *active_var = get_variable_as_string("ab_revert.active_var");
+    const char *active = ab_revert_getenv(active_var);
+    const char *other;
+    if (strcmp(active, "a") == 0)
+        other = "b";
+    else if (strcmp(active, "b") == 0)
+        other = "a";
+    else {
+        info("Failure to revert since %s is '%s' rather than 'a' or 'b'", active_var, active);
+        return term_new_boolean(false);
+    }
+
+    // Don't switch to a slot that was never written
+    const char *require_var = get_variable_as_string("ab_revert.require_var");
+    if (*require_var != '\0') {
+        char name[128];
+        snprintf(name, sizeof(name), "%s.%s", other, require_var);
+        if (*ab_revert_getenv(name) == '\0') {
+            info("Failure to revert since %s isn't set", name);
+            return term_new_boolean(false);
+        }
+    }
+
+    // Check everything first so that a bad entry doesn't leave a half
+    // reverted environment for a later saveenv()
+    const char *setenv_list = get_variable_as_string("ab_revert.setenv");
+    if (!uboot_env_name_valid(active_var) || ab_revert_setenv_list(setenv_list, false) < 0) {
+        info("Failure to revert since ab_revert.setenv or ab_revert.active_var is invalid");
+        return term_new_boolean(false);
+    }
+    if (uboot_env_setenv(&working_uboot_env, active_var, other) < 0 ||
+        ab_revert_setenv_list(setenv_list, true) < 0) {
+        info("Failure to revert since the U-Boot environment couldn't be updated");
+        return term_new_boolean(false);
+    }
+
+    set_boolean_variable("uboot_env.modified", true);
+    function_saveenv(NULL);
+    if (get_variable_as_boolean("uboot_env.modified")) {
+        info("Failure to revert since the U-Boot environment couldn't be saved");
+        return term_new_boolean(false);
+    }
+
+    info("Reverted to firmware slot %s", other);
+    set_boolean_variable("bootstats.fallback", true);
+    bootstats_record();
+
+    reboot(LINUX_REBOOT_CMD_RESTART);
+    exit(EXIT_FAILURE);
+}
+static int read_gpt_attributes(const struct term *parameters, uint64_t *attributes)
+{
+    const char *devpathspec = term_to_string(parameters)->string;
+    int partition = term_to_number(parameters->next);
+
+    // The GPT is only read the first time that it's needed. It's read again
+    // after gpt_set_attributes() changes it.
+    const struct gpt *gpt = gpt_cache_lookup(devpathspec);
+    if (!gpt) {
+        char devpath[BLOCK_DEVICE_PATH_LEN];
+        int fd = open_block_device(devpathspec, O_RDONLY, devpath);
+        if (fd < 0) {
+            info("Could not open '%s'", devpathspec);
+            return -1;
+        }
+
+        struct gpt loaded;
+        int rc = gpt_load(fd, &loaded, true);
+        close(fd);
+        if (rc < 0)
+            return -1;
+        gpt = gpt_cache_store(devpathspec, &loaded);
+    }
+
+    const uint8_t *entry = gpt_entry(gpt, partition);
+    if (!entry) {
+        warn("Invalid GPT partition number %d", partition);
+        return -1;
+    }
+    *attributes = gpt_entry_attributes(entry);
+    return 0;
+}
+static const struct term *function_gpt_priority(const struct term *parameters)
+{
+    // Partitions that can't be read get priority 0 so they're never picked
+    uint64_t attributes;
+    if (read_gpt_attributes(parameters, &attributes) < 0)
+        return term_new_number(0);
+
+    return term_new_number((attributes >> GPT_ATTR_PRIORITY_SHIFT) & GPT_ATTR_PRIORITY_MASK);
+}
+static const struct term *function_gpt_tries(const struct term *parameters)
+{
+    uint64_t attributes;
+    if (read_gpt_attributes(parameters, &attributes) < 0)
+        return term_new_number(0);
+
+    return term_new_number((attributes >> GPT_ATTR_TRIES_SHIFT) & GPT_ATTR_TRIES_MASK);
+}
+static const struct term *function_gpt_successful(const struct term *parameters)
+{
+    uint64_t attributes;
+    if (read_gpt_attributes(parameters, &attributes) < 0)
+        return term_new_boolean(false);
+
+    return term_new_boolean((attributes >> GPT_ATTR_SUCCESSFUL_SHIFT) & GPT_ATTR_SUCCESSFUL_MASK);
+}
+static const struct term *function_gpt_set_attributes(const struct term *parameters)
+{
+    const char *devpathspec = term_to_string(parameters)->string;
+    int partition = term_to_number(parameters->next);
+    uint64_t priority = term_to_number(parameters->next->next);
+    uint64_t tries = term_to_number(parameters->next->next->next);
+    uint64_t successful = term_to_boolean(parameters->next->next->next->next);
+    char devpath[BLOCK_DEVICE_PATH_LEN];
+
+    int fd = open_block_device(devpathspec, O_RDWR, devpath);
+    if (fd < 0) {
+        info("Could not open '%s'", devpathspec);
+        return term_new_boolean(false);
+    }
+
+    // Keep the other attribute bits as they are
+    uint64_t mask = (GPT_ATTR_PRIORITY_MASK << GPT_ATTR_PRIORITY_SHIFT) |
+                    (GPT_ATTR_TRIES_MASK << GPT_ATTR_TRIES_SHIFT) |
+                    (GPT_ATTR_SUCCESSFUL_MASK << GPT_ATTR_SUCCESSFUL_SHIFT);
+    uint64_t attributes = ((priority & GPT_ATTR_PRIORITY_MASK) << GPT_ATTR_PRIORITY_SHIFT) |
+                          ((tries & GPT_ATTR_TRIES_MASK) << GPT_ATTR_TRIES_SHIFT) |
+                          ((successful & GPT_ATTR_SUCCESSFUL_MASK) << GPT_ATTR_SUCCESSFUL_SHIFT);
+    int rc = gpt_write_attributes(fd, partition, mask, attributes);
+    close(fd);
+
+    // The disk may be cached under another spec, so drop every cached GPT
+    if (rc == 0) {
+        gpt_cache_clear();
+        cache_clear();
+    }
+
+    return term_new_boolean(rc == 0);
+}
 static const struct term *function_ls(const struct term *parameters)
 {
     const char *path = parameters ? term_to_string(parameters)->string : "/";
@@ -671,9 +1534,21 @@ static const struct term *function_sleep(const struct term *parameters)
     usleep(milliseconds * 1000);
     return NULL;
 }
-static const struct term *function_readfile(const struct term *parameters)
+static const struct term *read_file(const char *path, bool cached)
 {
-    const char *path = term_to_string(parameters)->string;
+    // The leading 'f' keeps path keys from colliding with cmd_cached/1 keys.
+    char key[256];
+    size_t key_len = 0;
+    if (cached) {
+        key_len = snprintf(key, sizeof(key), "f%s", path) + 1;
+        if (key_len > sizeof(key))
+            cached = false;
+        else {
+            const char *value = cache_lookup(key, key_len);
+            if (value)
+                return term_new_string(value);
+        }
+    }
 
     FILE *fp = fopen(path, "rb");
     if (fp) {
@@ -681,35 +1556,329 @@ static const struct term *function_readfile(const struct term *parameters)
         size_t len = fread(buffer, 1, sizeof(buffer) - 1, fp);
         buffer[len] = 0;
         fclose(fp);
+        if (cached)
+            cache_store(key, key_len, buffer);
         return term_new_string(buffer);
     } else {
         info("Error reading %s", path);
         return term_new_string("");
     }
 }
+static const struct term *function_readfile(const struct term *parameters)
+{
+    return read_file(term_to_string(parameters)->string, false);
+}
+static const struct term *function_readfile_cached(const struct term *parameters)
+{
+    return read_file(term_to_string(parameters)->string, true);
+}
+
+static const struct term *function_substr(const struct term *parameters)
+{
+    const char *str = term_to_string(parameters)->string;
+    int start = term_to_number(parameters->next);
+    size_t str_len = strlen(str);
+
+    // Negative starts count back from the end like in most languages
+    if (start < 0)
+        start = (int) str_len + start > 0 ? (int) str_len + start : 0;
+    if ((size_t) start > str_len)
+        start = str_len;
+
+    size_t len = str_len - start;
+    if (parameters->next->next) {
+        int requested = term_to_number(parameters->next->next);
+        if (requested < 0)
+            requested = 0;
+        if ((size_t) requested < len)
+            len = requested;
+    }
+    return term_new_substring(str + start, len);
+}
+static const struct term *function_field(const struct term *parameters)
+{
+    const char *str = term_to_string(parameters)->string;
+    const char *delimiters = term_to_string(parameters->next)->string;
+    int index = term_to_number(parameters->next->next);
+
+    // Fields are numbered from 1 like "cut -f"
+    const char *start = str;
+    for (int i = 1; i < index; i++) {
+        start += strcspn(start, delimiters);
+        if (*start == '\0')
+            return term_new_string("");
+        start++;
+    }
+    if (index < 1)
+        return term_new_string("");
+
+    return term_new_substring(start, strcspn(start, delimiters));
+}
+static const struct term *function_contains(const struct term *parameters)
+{
+    const char *str = term_to_string(parameters)->string;
+    const char *substring = term_to_string(parameters->next)->string;
+    return term_new_boolean(strstr(str, substring) != NULL);
+}
+static const struct term *function_starts_with(const struct term *parameters)
+{
+    const char *str = term_to_string(parameters)->string;
+    const char *prefix = term_to_string(parameters->next)->string;
+    return term_new_boolean(strncmp(str, prefix, strlen(prefix)) == 0);
+}
+static const struct term *function_regex_match(const struct term *parameters)
+{
+    const char *str = term_to_string(parameters)->string;
+    const char *pattern = term_to_string(parameters->next)->string;
+
+    regex_t regex;
+    int rc = regcomp(&regex, pattern, REG_EXTENDED | REG_NOSUB);
+    if (rc != 0) {
+        char errbuf[128];
+        regerror(rc, &regex, errbuf, sizeof(errbuf));
+        info("Invalid regex '%s': %s", pattern, errbuf);
+        return term_new_boolean(false);
+    }
+
+    bool matched = regexec(&regex, str, 0, NULL, 0) == 0;
+    regfree(&regex);
+    return term_new_boolean(matched);
+}
+static const struct term *function_hex_encode(const struct term *parameters)
+{
+    static const char digits[] = "0123456789abcdef";
+    const struct term *value = term_resolve(parameters);
+    const char *str;
+    size_t len;
+    if (value->kind == term_binary) {
+        str = (const char *) value->binary.data;
+        len = value->binary.length;
+    } else {
+        str = term_to_string(value)->string;
+        len = strlen(str);
+    }
+
+    struct term *rv = term_new_string_buffer(len * 2);
+    for (size_t i = 0; i < len; i++) {
+        rv->string[i * 2] = digits[(uint8_t) str[i] >> 4];
+        rv->string[i * 2 + 1] = digits[(uint8_t) str[i] & 0xf];
+    }
+    return rv;
+}
+static int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    else if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    else
+        return -1;
+}
+static const struct term *function_hex_decode(const struct term *parameters)
+{
+    const char *hex = term_to_string(parameters)->string;
+    size_t len = strlen(hex);
+    if (len % 2) {
+        info("hex_decode: odd number of hex digits in '%s'", hex);
+        return term_new_binary(NULL, 0);
+    }
+
+    struct term *rv = term_new_binary(NULL, len / 2);
+    for (size_t i = 0; i < len / 2; i++) {
+        int hi = hex_digit(hex[i * 2]);
+        int lo = hex_digit(hex[i * 2 + 1]);
+        if (hi < 0 || lo < 0) {
+            info("hex_decode: invalid hex digit in '%s'", hex);
+            return term_new_binary(NULL, 0);
+        }
+        rv->binary.data[i] = (uint8_t) ((hi << 4) | lo);
+    }
+    return rv;
+}
+static const struct term *function_to_upper(const struct term *parameters)
+{
+    const char *str = term_to_string(parameters)->string;
+    size_t len = strlen(str);
+
+    struct term *rv = term_new_string_buffer(len);
+    for (size_t i = 0; i < len; i++)
+        rv->string[i] = toupper((unsigned char) str[i]);
+    return rv;
+}
+static const struct term *function_trim(const struct term *parameters)
+{
+    const char *str = term_to_string(parameters)->string;
+    while (isspace((unsigned char) *str))
+        str++;
+
+    size_t len = strlen(str);
+    while (len > 0 && isspace((unsigned char) str[len - 1]))
+        len--;
+
+    return term_new_substring(str, len);
+}
+
+// Script numbers are ints, so offsets past 2 GiB have to be passed as
+// strings like "0x100000000". Those are parsed in full here rather than by
+// term_to_number(). Negative offsets and ones that don't fit in an off_t are
+// rejected.
+static int term_to_offset(const struct term *rv, off_t *offset)
+{
+    rv = term_resolve(rv);
+    if (rv->kind == term_number) {
+        if (rv->number < 0)
+            return -1;
+        *offset = rv->number;
+        return 0;
+    }
+
+    const char *str = term_to_string(rv)->string;
+    str += strspn(str, " \t");
+    if (*str == '-')
+        return -1;
+
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(str, &end, 0);
+    if (errno != 0 || end == str || value > INT64_MAX || (unsigned long long) (off_t) value != value)
+        return -1;
+
+    *offset = (off_t) value;
+    return 0;
+}
+static const struct term *function_readblock(const struct term *parameters)
+{
+    const char *spec = term_to_string(parameters)->string;
+    int length = term_to_number(parameters->next->next);
+    off_t offset;
+
+    if (term_to_offset(parameters->next, &offset) < 0) {
+        info("Invalid offset '%s' for '%s'", term_to_string(parameters->next)->string, spec);
+        return term_new_binary(NULL, 0);
+    }
+
+    // Everything ends up on the script heap, so cap reads like readfile/1.
+    // A length of 0 reads as much as allowed.
+    if (length <= 0 || length > HEAP_SIZE / 4)
+        length = HEAP_SIZE / 4;
+
+    char path[BLOCK_DEVICE_PATH_LEN];
+    int fd = open_block_device(spec, O_RDONLY, path);
+    if (fd < 0)
+        return term_new_binary(NULL, 0);
+
+    struct term *rv = term_new_binary(NULL, length);
+    ssize_t amount_read = pread(fd, rv->binary.data, length, offset);
+    close(fd);
+
+    if (amount_read < 0) {
+        info("Could not read %d bytes at offset %llu from '%s'", length, (unsigned long long) offset, path);
+        amount_read = 0;
+    }
+    rv->binary.length = amount_read;
+    rv->binary.data[amount_read] = '\0';
+    return rv;
+}
+static const uint8_t *get_cell(const struct term *parameters, size_t cell_size)
+{
+    const struct term *value = term_resolve(parameters);
+    int index = term_to_number(parameters->next);
+    if (value->kind != term_binary || index < 0 ||
+        (size_t) index >= value->binary.length / cell_size) {
+        info("No %d-bit cell at index %d", (int) cell_size * 8, index);
+        return NULL;
+    }
+    return value->binary.data + (size_t) index * cell_size;
+}
+static const struct term *function_dt_u32(const struct term *parameters)
+{
+    // Device tree properties are arrays of big-endian 32-bit cells.
+    const uint8_t *cell = get_cell(parameters, 4);
+    if (!cell)
+        return term_new_number(0);
+
+    uint32_t value = ((uint32_t) cell[0] << 24) | (cell[1] << 16) | (cell[2] << 8) | cell[3];
+    return term_new_number((int) value);
+}
+static const struct term *function_dt_u64(const struct term *parameters)
+{
+    // 64-bit values don't fit in numbers, so return them as hex strings.
+    const uint8_t *cell = get_cell(parameters, 8);
+    if (!cell)
+        return term_new_string("");
+
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++)
+        value = (value << 8) | cell[i];
+
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), "0x%016llx", (unsigned long long) value);
+    return term_new_string(buffer);
+}
+
+static const struct term *function_time(const struct term *parameters)
+{
+    uint64_t start = now_ns();
+    const struct term *result = term_resolve(parameters);
+    uint64_t elapsed = now_ns() - start;
+
+    fprintf(stderr, "%llu.%03llu ms\n",
+            (unsigned long long) (elapsed / 1000000),
+            (unsigned long long) (elapsed / 1000 % 1000));
+    return result;
+}
 
 static const struct term *function_help(const struct term *parameters);
+static const struct term *function_profile(const struct term *parameters);
 
 // Function lookup table
 static struct function_info function_table[] = {
     {"=", 2, function_assign, NULL},
     {"+", 2, function_add, NULL},
     {"-", 2, function_subtract, NULL},
+    {"ab_revert", 0, function_ab_revert, "revert to the other A/B firmware slot without running fwup"},
     {"blkid", 0, function_blkid, "list block devices"},
+    {"bootstate_load", 0, function_bootstate_load, "load the newest boot state record into the bootstate.* variables"},
+    {"bootstate_save", 0, function_bootstate_save, "write the bootstate.* variables to the next boot state record"},
+    {"bootstats", 0, function_bootstats, "print boot time statistics from recent boots"},
     {"cmd", 1, function_cmd, "run an external command"},
+    {"cmd_cached", 1, function_cmd_cached, "run an external command once and reuse its output"},
+    {"contains", 2, function_contains, "return true if a string contains a substring"},
+    {"dt_u32", 2, function_dt_u32, "decode 32-bit big-endian cell n of a binary, like from a device tree property"},
+    {"dt_u64", 2, function_dt_u64, "decode 64-bit big-endian cell n of a binary as a hex string"},
     {"env", 0, function_env, "print all loaded U-Boot variables"},
+    {"field", 3, function_field, "return field n (starting at 1) of a string split on delimiter characters"},
     {"fwup_revert", 0, function_fwup_revert, "revert to the previous firmware image"},
     {"getenv", 1, function_getenv, "get the value of a U-Boot variable"},
+    {"gpt_priority", 2, function_gpt_priority, "return the ChromeOS priority attribute (0-15) of a GPT partition"},
+    {"gpt_set_attributes", 5, function_gpt_set_attributes, "set the ChromeOS priority, tries and successful attributes of a GPT partition"},
+    {"gpt_successful", 2, function_gpt_successful, "return the ChromeOS successful attribute of a GPT partition"},
+    {"gpt_tries", 2, function_gpt_tries, "return the ChromeOS tries attribute (0-15) of a GPT partition"},
     {"help", 0, function_help, "print out help in the REPL"},
+    {"hex_decode", 1, function_hex_decode, "convert hex digits to a binary"},
+    {"hex_encode", 1, function_hex_encode, "convert a string or binary to hex digits"},
+    {"join", 1, function_join, "wait for a spawned command and return its output"},
     {"loadenv", 0, function_loadenv, "load a U-Boot environment block"},
     {"ls", 0, function_ls, "list files"},
     {"poweroff", 0, function_poweroff, "power off the device"},
     {"print", 1, function_print, "print one or more strings and variables"},
+    {"profile", 0, function_profile, "print call counts and times when profile.enabled is set"},
+    {"readblock", 3, function_readblock, "read length bytes at offset from a block device or file as a binary"},
     {"readfile", 1, function_readfile, "read a file (truncates long files)"},
+    {"readfile_cached", 1, function_readfile_cached, "read a file once and reuse its contents"},
     {"reboot", 0, function_reboot, "reset the device"},
+    {"regex_match", 2, function_regex_match, "return true if a string matches a POSIX extended regular expression"},
     {"saveenv", 0, function_saveenv, "save all U-Boot variables back to storage"},
     {"setenv", 2, function_setenv, "set a U-Boot variable. It is not saved until you call saveenv/0"},
     {"sleep", 0, function_sleep, "sleep for n milliseconds"},
+    {"spawn", 1, function_spawn, "start an external command and return a handle for join/1"},
+    {"starts_with", 2, function_starts_with, "return true if a string starts with a prefix"},
+    {"substr", 2, function_substr, "return the part of a string from start for an optional length"},
+    {"time", 1, function_time, "evaluate an expression and print how long it took"},
+    {"to_upper", 1, function_to_upper, "convert a string to upper case"},
+    {"trim", 1, function_trim, "remove leading and trailing whitespace"},
     {"vars", 0, function_vars, "print all known variables and their values"},
     {NULL, 0, NULL, NULL}
 };
@@ -734,6 +1903,56 @@ const struct function_info *function_info_by_fun(fun_handler fun)
     return entry;
 }
 
+struct function_stats
+{
+    unsigned int calls;
+    uint64_t total_ns;
+    uint64_t max_ns;
+};
+
+static struct function_stats function_stats[sizeof(function_table) / sizeof(function_table[0])];
+
+static void profile_record(fun_handler fun, uint64_t elapsed_ns)
+{
+    struct function_stats *stats = &function_stats[function_info_by_fun(fun) - function_table];
+    stats->calls++;
+    stats->total_ns += elapsed_ns;
+    if (elapsed_ns > stats->max_ns)
+        stats->max_ns = elapsed_ns;
+}
+
+void profile_report()
+{
+    if (!profiling)
+        return;
+
+    // Logged as warnings so that the report isn't held back or dropped when
+    // log.level is set to only show warnings and errors
+    warn("profile: function calls total_us max_us");
+    for (size_t i = 0; function_table[i].name; i++) {
+        const struct function_stats *stats = &function_stats[i];
+        if (stats->calls) {
+            warn("profile: %s/%d %u %llu %llu",
+                 function_table[i].name,
+                 function_table[i].arity,
+                 stats->calls,
+                 (unsigned long long) (stats->total_ns / 1000),
+                 (unsigned long long) (stats->max_ns / 1000));
+        }
+    }
+}
+
+static const struct term *function_profile(const struct term *parameters)
+{
+    (void)parameters;
+
+    if (!profiling)
+        info("Set profile.enabled to record function calls");
+
+    profile_report();
+    return NULL;
+}
+
 const struct term *function_help(const struct term *parameters)
 {
     (void)parameters;
@@ -741,9 +1960,9 @@ const struct term *function_help(const struct term *parameters)
     struct function_info *entry = function_table;
     while (entry->handler) {
         if (entry->description) {
-            char buf[16];
+            char buf[32];
             snprintf(buf, sizeof(buf), "%s/%d", entry->name, entry->arity);
-            fprintf(stderr, "%-16s%s\n", buf, entry->description);
+            fprintf(stderr, "%-20s%s\n", buf, entry->description);
         }
         entry++;
     }
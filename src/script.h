@@ -2,6 +2,8 @@
 #define SCRIPT_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 typedef const struct term *(*fun_handler)(const struct term *);
 
@@ -26,7 +28,8 @@ struct term
         term_number,
         term_boolean,
         term_fun,
-        term_variable
+        term_variable,
+        term_binary
     } kind;
     union {
         char *identifier;
@@ -35,6 +38,10 @@ struct term
         bool boolean;
         struct function fun;
         struct variable var;
+        struct {
+            uint8_t *data;
+            size_t length;
+        } binary;
     };
     struct term *next;
 };
@@ -51,12 +58,16 @@ fun_handler lookup_function(const char *name, int arity);
 const struct function_info *function_info_by_fun(fun_handler fun);
 
 const struct term *run_functions(const struct term *rv);
+void profile_report();
+void bootstats_open();
+void bootstats_record();
 
 void term_gc_heap();
 struct term *term_new_number(int value);
 struct term *term_new_string(const char *value);
 struct term *term_new_qstring(const char *value);
 struct term *term_new_boolean(bool value);
+struct term *term_new_binary(const uint8_t *data, size_t length);
 struct term *term_new_identifier(const char *value);
 struct term *term_new_fun(const char *name, struct term *parameters);
 struct term *term_dupe(const struct term *rv);
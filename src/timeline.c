@@ -0,0 +1,408 @@
+#include "timeline.h"
+#include "trace.h"
+#include "util.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/statfs.h>
+
+// Everything is in fixed arrays since this runs on every boot and the
+// timeline needs to survive until the very end.
+#define TIMELINE_MAX_PHASES     32
+#define TIMELINE_MAX_DEPTH      8
+#define TIMELINE_MAX_STATEMENTS 256
+#define TIMELINE_MAX_VALUES     8
+
+// Lines are about 100 bytes, so this fits a handful of disks plus the usual
+// loop and ram devices in one read
+#define DISKSTATS_BUFFER_SIZE 8192
+
+struct timeline_io
+{
+    uint64_t ios;
+    uint64_t sectors_read;
+    uint64_t sectors_written;
+    uint64_t queue_ms;
+};
+
+struct timeline_phase
+{
+    const char *name;
+    int depth;
+    bool open;
+    uint64_t begin_ns;
+    uint64_t end_ns;
+
+    // Set when the closing samples were taken before the end
+    bool sampled;
+
+    // Totals at the beginning and then the difference at the end
+    bool has_io;
+    struct timeline_io io;
+
+    // Memory at the end
+    bool has_mem;
+    uint64_t mem_available_kb;
+    uint64_t rootfs_used_kb;
+};
+
+struct timeline_value
+{
+    const char *name;
+    uint64_t value;
+};
+
+struct timeline_statement
+{
+    int line;
+    uint64_t begin_ns;
+    uint64_t end_ns;
+};
+
+static struct timeline_phase phases[TIMELINE_MAX_PHASES];
+static int phase_count = 0;
+
+// Indices into phases[] for the ones that haven't ended. -1 if the phase
+// didn't fit.
+static int open_phases[TIMELINE_MAX_DEPTH];
+static int depth = 0;
+
+static struct timeline_statement statements[TIMELINE_MAX_STATEMENTS];
+static int statement_count = 0;
+static unsigned int dropped_statements = 0;
+
+static struct timeline_value values[TIMELINE_MAX_VALUES];
+static int value_count = 0;
+
+// Reading /proc and calling statfs on every phase boundary isn't free, so
+// it's only done when asked for.
+static bool sampling = false;
+
+uint64_t timeline_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool ignored_device(const char *name, const char *last_disk)
+{
+    // RAM-backed and stacked devices would count I/O twice or not be I/O
+    // to media at all.
+    if (strncmp(name, "loop", 4) == 0 ||
+        strncmp(name, "ram", 3) == 0 ||
+        strncmp(name, "zram", 4) == 0 ||
+        strncmp(name, "dm-", 3) == 0)
+        return true;
+
+    // Partitions come right after their disk and would also count twice.
+    // E.g., mmcblk0p1 after mmcblk0 or sda1 after sda. eMMC boot partitions
+    // like mmcblk0boot0 are separate devices, though.
+    size_t len = strlen(last_disk);
+    if (len == 0 || strncmp(name, last_disk, len) != 0)
+        return false;
+
+    const char *suffix = name + len;
+    if (*suffix == 'p')
+        suffix++;
+    if (*suffix == '\0')
+        return false;
+    while (*suffix >= '0' && *suffix <= '9')
+        suffix++;
+    return *suffix == '\0';
+}
+
+static void add_diskstats_line(struct timeline_io *io, const char *line, char *last_disk)
+{
+    char name[32];
+    unsigned long long reads, sectors_read, writes, sectors_written, queue_ms;
+    if (sscanf(line, "%*u %*u %31s %llu %*u %llu %*u %llu %*u %llu %*u %*u %*u %llu",
+               name, &reads, &sectors_read, &writes, &sectors_written, &queue_ms) == 6 &&
+        !ignored_device(name, last_disk)) {
+        strcpy(last_disk, name);
+        io->ios += reads + writes;
+        io->sectors_read += sectors_read;
+        io->sectors_written += sectors_written;
+        io->queue_ms += queue_ms;
+    }
+}
+
+// Sum up I/O to the disks from /proc/diskstats. It's read a buffer at a time
+// since it can be long on systems with lots of block devices.
+static int sample_diskstats(struct timeline_io *io)
+{
+    int fd = open("/proc/diskstats", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    memset(io, 0, sizeof(*io));
+
+    char buffer[DISKSTATS_BUFFER_SIZE];
+    char last_disk[32] = "";
+    size_t kept = 0;
+    for (;;) {
+        ssize_t len = read(fd, buffer + kept, sizeof(buffer) - 1 - kept);
+        if (len < 0) {
+            close(fd);
+            return -1;
+        }
+        if (len == 0)
+            break;
+        kept += len;
+        buffer[kept] = '\0';
+
+        // Only parse whole lines. The partial one at the end is moved to the
+        // front to be finished by the next read.
+        char *line = buffer;
+        char *next;
+        while ((next = strchr(line, '\n')) != NULL) {
+            *next++ = '\0';
+            add_diskstats_line(io, line, last_disk);
+            line = next;
+        }
+        kept = buffer + kept - line;
+        if (kept == sizeof(buffer) - 1)
+            kept = 0; // No line is this long, so skip it
+        memmove(buffer, line, kept);
+    }
+    close(fd);
+
+    // The file normally ends with a newline, but just in case
+    if (kept > 0) {
+        buffer[kept] = '\0';
+        add_diskstats_line(io, buffer, last_disk);
+    }
+    return 0;
+}
+
+// Sample how much RAM is left and how much the initramfs uses. The latter
+// only works when the initramfs is a tmpfs since ramfs doesn't track it.
+static int sample_memory(uint64_t *available_kb, uint64_t *rootfs_used_kb)
+{
+    int fd = open("/proc/meminfo", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    // MemAvailable is near the top
+    char buffer[512];
+    ssize_t len = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (len < 0)
+        return -1;
+    buffer[len] = '\0';
+
+    const char *line = strstr(buffer, "MemAvailable:");
+    unsigned long long kb;
+    if (!line || sscanf(line, "MemAvailable: %llu", &kb) != 1)
+        return -1;
+    *available_kb = kb;
+
+    struct statfs st;
+    if (statfs("/", &st) == 0)
+        *rootfs_used_kb = (uint64_t) (st.f_blocks - st.f_bfree) * st.f_bsize / 1024;
+    else
+        *rootfs_used_kb = 0;
+    return 0;
+}
+
+void timeline_begin(const char *name)
+{
+    trace_begin(name);
+
+    int index = -1;
+    if (phase_count < TIMELINE_MAX_PHASES) {
+        index = phase_count++;
+        struct timeline_phase *p = &phases[index];
+        p->name = name;
+        p->depth = depth;
+        p->open = true;
+        p->has_io = sampling && sample_diskstats(&p->io) == 0;
+        p->has_mem = false;
+        p->sampled = !sampling;
+        p->begin_ns = timeline_now_ns();
+        p->end_ns = p->begin_ns;
+    }
+
+    if (depth < TIMELINE_MAX_DEPTH)
+        open_phases[depth] = index;
+    depth++;
+}
+
+static void sample_end(struct timeline_phase *p)
+{
+    struct timeline_io now;
+    if (p->has_io && sample_diskstats(&now) == 0) {
+        p->io.ios = now.ios - p->io.ios;
+        p->io.sectors_read = now.sectors_read - p->io.sectors_read;
+        p->io.sectors_written = now.sectors_written - p->io.sectors_written;
+        p->io.queue_ms = now.queue_ms - p->io.queue_ms;
+    } else {
+        p->has_io = false;
+    }
+
+    p->has_mem = sample_memory(&p->mem_available_kb, &p->rootfs_used_kb) == 0;
+}
+
+static struct timeline_phase *innermost_phase()
+{
+    if (depth == 0 || depth > TIMELINE_MAX_DEPTH || open_phases[depth - 1] < 0)
+        return NULL;
+
+    return &phases[open_phases[depth - 1]];
+}
+
+void timeline_end()
+{
+    struct timeline_phase *p = innermost_phase();
+    if (depth == 0)
+        return;
+
+    trace_end();
+    depth--;
+    if (!p)
+        return;
+
+    p->open = false;
+    p->end_ns = timeline_now_ns();
+    if (!p->sampled)
+        sample_end(p);
+}
+
+void timeline_sample()
+{
+    struct timeline_phase *p = innermost_phase();
+    if (p && !p->sampled) {
+        sample_end(p);
+        p->sampled = true;
+    }
+}
+
+void timeline_mark(const char *name)
+{
+    // Marks are instants, so there's no I/O to measure
+    trace_begin(name);
+    trace_end();
+
+    if (phase_count < TIMELINE_MAX_PHASES) {
+        struct timeline_phase *p = &phases[phase_count++];
+        p->name = name;
+        p->depth = depth;
+        p->open = false;
+        p->has_io = false;
+        p->has_mem = false;
+        p->sampled = false;
+        p->begin_ns = timeline_now_ns();
+        p->end_ns = p->begin_ns;
+    }
+}
+
+void timeline_set_sampling(bool enabled)
+{
+    sampling = enabled;
+}
+
+void timeline_statement_begin(int line)
+{
+    if (statement_count < TIMELINE_MAX_STATEMENTS) {
+        struct timeline_statement *s = &statements[statement_count];
+        s->line = line;
+        s->begin_ns = timeline_now_ns();
+    }
+}
+
+void timeline_statement_end()
+{
+    // The end time includes evaluating the statement's conditions and
+    // actions since that happens while it's being parsed.
+    if (statement_count < TIMELINE_MAX_STATEMENTS)
+        statements[statement_count++].end_ns = timeline_now_ns();
+    else
+        dropped_statements++;
+}
+
+void timeline_value(const char *name, uint64_t value)
+{
+    if (value_count < TIMELINE_MAX_VALUES) {
+        values[value_count].name = name;
+        values[value_count].value = value;
+        value_count++;
+    }
+}
+
+uint64_t timeline_summary(const char **slowest_name, uint64_t *slowest_ns)
+{
+    uint64_t now = timeline_now_ns();
+
+    *slowest_name = "";
+    *slowest_ns = 0;
+    for (int i = 0; i < phase_count; i++) {
+        const struct timeline_phase *p = &phases[i];
+        if (p->depth != 0)
+            continue;
+
+        uint64_t elapsed = (p->open ? now : p->end_ns) - p->begin_ns;
+        if (elapsed > *slowest_ns) {
+            *slowest_name = p->name;
+            *slowest_ns = elapsed;
+        }
+    }
+
+    return phase_count > 0 ? now - phases[0].begin_ns : 0;
+}
+
+int timeline_write(const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+        return -1;
+
+    // One record per line. Times are CLOCK_BOOTTIME microseconds.
+    fprintf(fp, "version 1\n");
+    for (int i = 0; i < phase_count; i++) {
+        const struct timeline_phase *p = &phases[i];
+        fprintf(fp, "phase %d %s %llu %llu\n",
+                p->depth,
+                p->name,
+                (unsigned long long) (p->begin_ns / 1000),
+                (unsigned long long) (p->end_ns / 1000));
+        if (p->has_io) {
+            fprintf(fp, "io %llu %llu %llu %llu\n",
+                    (unsigned long long) p->io.ios,
+                    (unsigned long long) p->io.sectors_read,
+                    (unsigned long long) p->io.sectors_written,
+                    (unsigned long long) p->io.queue_ms);
+        }
+        if (p->has_mem) {
+            fprintf(fp, "mem %llu %llu\n",
+                    (unsigned long long) p->mem_available_kb,
+                    (unsigned long long) p->rootfs_used_kb);
+        }
+    }
+    for (int i = 0; i < statement_count; i++) {
+        const struct timeline_statement *s = &statements[i];
+        fprintf(fp, "statement %d %llu %llu\n",
+                s->line,
+                (unsigned long long) (s->begin_ns / 1000),
+                (unsigned long long) (s->end_ns / 1000));
+    }
+    if (dropped_statements)
+        fprintf(fp, "dropped_statements %u\n", dropped_statements);
+
+    for (int i = 0; i < value_count; i++)
+        fprintf(fp, "value %s %llu\n", values[i].name, (unsigned long long) values[i].value);
+
+    // ru_maxrss is the same as VmHWM in /proc/self/status
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        fprintf(fp, "value peak_rss_kb %ld\n", usage.ru_maxrss);
+
+    bool ok = !ferror(fp);
+    if (fclose(fp) != 0)
+        ok = false;
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,34 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Boot phases are recorded with CLOCK_BOOTTIME timestamps so that they line
+// up with the kernel's and the next init's view of time. Phases can nest.
+void timeline_begin(const char *name);
+void timeline_end(void);
+void timeline_mark(const char *name);
+
+// Record disk I/O and memory for phases that begin after this is enabled
+void timeline_set_sampling(bool enabled);
+
+// Take the I/O and memory samples for the end of the current phase now.
+// For phases that unmount /proc before they end.
+void timeline_sample(void);
+
+// Called by the parser around each script statement
+void timeline_statement_begin(int line);
+void timeline_statement_end(void);
+
+// Other measurements to include
+void timeline_value(const char *name, uint64_t value);
+
+int timeline_write(const char *path);
+
+// Time since entry and the slowest top-level phase so far
+uint64_t timeline_summary(const char **slowest_name, uint64_t *slowest_ns);
+
+uint64_t timeline_now_ns(void);
+
+#endif // TIMELINE_H
@@ -0,0 +1,95 @@
+#include "trace.h"
+#include "util.h"
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mount.h>
+
+#define TRACEFS_PATH "/sys/kernel/tracing"
+
+static int marker_fd = -1;
+static bool mounted_tracefs = false;
+
+static int open_marker(const char *path)
+{
+    marker_fd = open(path, O_WRONLY | O_CLOEXEC);
+    return marker_fd;
+}
+
+int trace_open()
+{
+    if (marker_fd >= 0)
+        return 0;
+
+    // Older kernels only have it under debugfs
+    if (open_marker(TRACEFS_PATH "/trace_marker") >= 0 ||
+        open_marker("/sys/kernel/debug/tracing/trace_marker") >= 0)
+        return 0;
+
+    OK_OR_RETURN_MSG(mount("tracefs", TRACEFS_PATH, "tracefs", MS_NOSUID | MS_NODEV | MS_NOEXEC, NULL),
+                     "Can't mount tracefs. Check CONFIG_FTRACE");
+    mounted_tracefs = true;
+
+    if (open_marker(TRACEFS_PATH "/trace_marker") < 0) {
+        trace_detach();
+        ERR_RETURN("Can't open trace_marker");
+    }
+    return 0;
+}
+
+void trace_detach()
+{
+    // /sys gets unmounted before switching to the new root, so get out of
+    // the way. The marker stays usable until exec closes it.
+    if (mounted_tracefs) {
+        OK_OR_WARN(umount2(TRACEFS_PATH, MNT_DETACH), "Can't unmount tracefs");
+        mounted_tracefs = false;
+    }
+}
+
+static void write_marker(const char *fmt, ...)
+{
+    if (marker_fd < 0)
+        return;
+
+    char buffer[128];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(buffer, sizeof(buffer), fmt, ap);
+    va_end(ap);
+
+    if (len >= (int) sizeof(buffer)) {
+        len = sizeof(buffer) - 1;
+        buffer[len - 1] = '\n';
+    }
+
+    // Each marker has to be one write to show up as one event
+    if (len > 0) {
+        ssize_t ignore = write(marker_fd, buffer, len);
+        (void) ignore;
+    }
+}
+
+void trace_begin(const char *name)
+{
+    write_marker("B|%d|%s\n", getpid(), name);
+}
+
+void trace_end()
+{
+    write_marker("E|%d\n", getpid());
+}
+
+void trace_async_begin(const char *name, int cookie)
+{
+    write_marker("S|%d|%s|%d\n", getpid(), name, cookie);
+}
+
+void trace_async_end(const char *name, int cookie)
+{
+    write_marker("F|%d|%s|%d\n", getpid(), name, cookie);
+}
@@ -0,0 +1,14 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Userspace markers for ftrace's trace_marker. These use the atrace format
+// so that perfetto and systrace show them with the kernel's events.
+int trace_open(void);
+void trace_detach(void);
+
+void trace_begin(const char *name);
+void trace_end(void);
+void trace_async_begin(const char *name, int cookie);
+void trace_async_end(const char *name, int cookie);
+
+#endif // TRACE_H
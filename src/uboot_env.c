@@ -19,6 +19,7 @@
 #include "crc32.h"
 
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -27,27 +28,162 @@
 //                 U-boot especially since the U-boot environment data
 //                 structure is simple enough to reverse engineer by playing
 //                 with mkenvimage.
+
+// Environments are parsed in place. The raw block is copied once into an
+// arena and names and values point into it. Only setenv() copies strings.
+#define UBOOT_ARENA_CHUNK_SIZE 4096
+
+struct uboot_arena_chunk {
+    struct uboot_arena_chunk *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+static void *arena_alloc(struct uboot_env *env, size_t size)
+{
+    size = (size + 7) & ~7;
+
+    struct uboot_arena_chunk *chunk = env->arena;
+    if (!chunk || chunk->used + size > chunk->size) {
+        size_t chunk_size = size > UBOOT_ARENA_CHUNK_SIZE ? size : UBOOT_ARENA_CHUNK_SIZE;
+        chunk = malloc(sizeof(struct uboot_arena_chunk) + chunk_size);
+        chunk->used = 0;
+        chunk->size = chunk_size;
+
+        // Keep the chunk with the most room at the head for the next allocation.
+        if (env->arena && env->arena->size - env->arena->used > chunk_size - size) {
+            chunk->next = env->arena->next;
+            env->arena->next = chunk;
+        } else {
+            chunk->next = env->arena;
+            env->arena = chunk;
+        }
+    }
+
+    void *addr = &chunk->data[chunk->used];
+    chunk->used += size;
+    return addr;
+}
+
+static char *arena_strdup(struct uboot_env *env, const char *str)
+{
+    size_t len = strlen(str) + 1;
+    char *copy = arena_alloc(env, len);
+    memcpy(copy, str, len);
+    return copy;
+}
+
 void uboot_env_init(struct uboot_env *env)
 {
     memset(env, 0, sizeof(struct uboot_env));
 }
 
-int uboot_env_read(struct uboot_env *env, const char *buffer)
+// The hash index uses open addressing with linear probing. It's kept at
+// most half full so that probe sequences stay short.
+#define UBOOT_INDEX_MIN_SIZE 64
+
+static struct uboot_name_value **index_slot(struct uboot_env *env, const char *name, uint32_t hash)
 {
-    uboot_env_free(env);
+    size_t mask = env->index_size - 1;
+    size_t i = hash & mask;
+    while (env->index[i] != NULL) {
+        if (env->index[i]->hash == hash && strcmp(env->index[i]->name, name) == 0)
+            break;
+        i = (i + 1) & mask;
+    }
+    return &env->index[i];
+}
+
+static void index_resize(struct uboot_env *env, size_t new_size)
+{
+    free(env->index);
+    env->index = calloc(new_size, sizeof(struct uboot_name_value *));
+    env->index_size = new_size;
 
+    for (size_t i = 0; i < env->count; i++)
+        *index_slot(env, env->vars[i]->name, env->vars[i]->hash) = env->vars[i];
+}
+
+static struct uboot_name_value *lookup(struct uboot_env *env, const char *name, uint32_t hash)
+{
+    if (env->index_size == 0)
+        return NULL;
+    return *index_slot(env, name, hash);
+}
+
+// Return the position in the sorted array where name belongs
+static size_t sorted_position(struct uboot_env *env, const char *name)
+{
+    // Environments are almost always stored sorted, so check the end first.
+    if (env->count == 0 || strcmp(env->vars[env->count - 1]->name, name) < 0)
+        return env->count;
+
+    size_t lo = 0;
+    size_t hi = env->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(env->vars[mid]->name, name) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void insert(struct uboot_env *env, const char *name, const char *value, uint32_t hash)
+{
+    if (env->count == env->capacity) {
+        env->capacity = env->capacity ? env->capacity * 2 : UBOOT_INDEX_MIN_SIZE / 2;
+        env->vars = realloc(env->vars, env->capacity * sizeof(struct uboot_name_value *));
+    }
+    if ((env->count + 1) * 2 > env->index_size)
+        index_resize(env, env->index_size ? env->index_size * 2 : UBOOT_INDEX_MIN_SIZE);
+
+    struct uboot_name_value *pair = arena_alloc(env, sizeof(struct uboot_name_value));
+    pair->name = name;
+    pair->value = value;
+    pair->hash = hash;
+
+    size_t pos = sorted_position(env, name);
+    memmove(&env->vars[pos + 1], &env->vars[pos], (env->count - pos) * sizeof(struct uboot_name_value *));
+    env->vars[pos] = pair;
+    env->count++;
+
+    *index_slot(env, name, hash) = pair;
+}
+
+// Redundant environments have a flags byte between the CRC and the data
+static size_t header_size(const struct uboot_env *env)
+{
+    return env->redundant ? 5 : 4;
+}
+
+static int check_crc32(const struct uboot_env *env, const char *buffer)
+{
+    size_t offset = header_size(env);
     uint32_t expected_crc32 = ((uint8_t) buffer[0] | ((uint8_t) buffer[1] << 8) | ((uint8_t) buffer[2] << 16) | ((uint8_t) buffer[3] << 24));
-    uint32_t actual_crc32 = crc32buf(buffer + 4, env->env_size - 4);
+    uint32_t actual_crc32 = crc32buf(buffer + offset, env->env_size - offset);
     if (expected_crc32 != actual_crc32)
         ERR_RETURN("U-boot environment CRC32 mismatch (expected 0x%08x; got 0x%08x)", expected_crc32, actual_crc32);
 
-    const char *end = buffer + env->env_size;
-    const char *name = buffer + 4;
+    return 0;
+}
+
+static int parse(struct uboot_env *env, const char *buffer)
+{
+    char *block = arena_alloc(env, env->env_size);
+    memcpy(block, buffer, env->env_size);
+
+    char *end = block + env->env_size;
+    char *name = block + header_size(env);
     while (name != end && *name != '\0') {
-        const char *endname = name + 1;
+        char *endname = name + 1;
         for (;;) {
-            if (endname == end || *endname == '\0')
+            if (endname == end || *endname == '\0') {
+                uboot_env_free(env);
                 ERR_RETURN("Invalid U-boot environment");
+            }
 
             if (*endname == '=')
                 break;
@@ -55,11 +191,13 @@ int uboot_env_read(struct uboot_env *env, const char *buffer)
             endname++;
         }
 
-        const char *value = endname + 1;
-        const char *endvalue = value;
+        char *value = endname + 1;
+        char *endvalue = value;
         for (;;) {
-            if (endvalue == end)
+            if (endvalue == end) {
+                uboot_env_free(env);
                 ERR_RETURN("Invalid U-boot environment");
+            }
 
             if (*endvalue == '\0')
                 break;
@@ -67,11 +205,16 @@ int uboot_env_read(struct uboot_env *env, const char *buffer)
             endvalue++;
         }
 
-        struct uboot_name_value *pair = malloc(sizeof(struct uboot_name_value));
-        pair->name = strndup(name, endname - name);
-        pair->value = strndup(value, value - endvalue);
-        pair->next = env->vars;
-        env->vars = pair;
+        // Terminate the name in place. The value is already terminated.
+        *endname = '\0';
+
+        // Like U-Boot, the last definition of a duplicated name wins.
+        uint32_t hash = hash_bytes(name, endname - name);
+        struct uboot_name_value *pair = lookup(env, name, hash);
+        if (pair)
+            pair->value = value;
+        else
+            insert(env, name, value, hash);
 
         name = endvalue + 1;
     }
@@ -79,91 +222,82 @@ int uboot_env_read(struct uboot_env *env, const char *buffer)
     return 0;
 }
 
-int uboot_env_setenv(struct uboot_env *env, const char *name, const char *value)
+int uboot_env_read(struct uboot_env *env, const char *buffer)
 {
-    struct uboot_name_value *pair;
-    for (pair = env->vars; pair != NULL; pair = pair->next) {
-        if (strcmp(pair->name, name) == 0) {
-            free(pair->value);
-            pair->value = strdup(value);
-            return 0;
-        }
-    }
-    pair = malloc(sizeof(*pair));
-    pair->name = strdup(name);
-    pair->value = strdup(value);
-    pair->next = env->vars;
-    env->vars = pair;
-    return 0;
-}
+    uboot_env_free(env);
+    env->redundant = false;
 
-int uboot_env_unsetenv(struct uboot_env *env, const char *name)
-{
-    struct uboot_name_value *prev = NULL;
-    struct uboot_name_value *pair;
-    for (pair = env->vars;
-         pair != NULL;
-         prev = pair, pair = pair->next) {
-        if (strcmp(pair->name, name) == 0) {
-            if (prev)
-                prev->next = pair->next;
-            else
-                env->vars = pair->next;
-            free(pair->name);
-            free(pair->value);
-            free(pair);
-            break;
-        }
-    }
-    return 0;
+    if (check_crc32(env, buffer) < 0)
+        return -1;
+
+    return parse(env, buffer);
 }
 
-int uboot_env_getenv(struct uboot_env *env, const char *name, char **value)
+// Return true if flags a was written after flags b. The flags byte is a
+// counter that's incremented on every save and wraps from 255 to 0.
+static bool is_newer(uint8_t a, uint8_t b)
 {
-    struct uboot_name_value *pair;
-    for (pair = env->vars; pair != NULL; pair = pair->next) {
-        if (strcmp(pair->name, name) == 0) {
-            *value = strdup(pair->value);
-            return 0;
-        }
-    }
-
-    *value = NULL;
-    ERR_RETURN("variable '%s' not found", name);
+    if (a == 0 && b == 255)
+        return true;
+    if (a == 255 && b == 0)
+        return false;
+    return a > b;
 }
 
-static int env_name_compare(const void *a, const void *b)
+int uboot_env_read_redundant(struct uboot_env *env, const char *buffer0, const char *buffer1)
 {
-    struct uboot_name_value **apair = (struct uboot_name_value **) a;
-    struct uboot_name_value **bpair = (struct uboot_name_value **) b;
-
-    return strcmp((*apair)->name, (*bpair)->name);
+    uboot_env_free(env);
+    env->redundant = true;
+
+    bool valid0 = check_crc32(env, buffer0) == 0;
+    bool valid1 = check_crc32(env, buffer1) == 0;
+    if (!valid0 && !valid1)
+        ERR_RETURN("Both copies of the redundant U-boot environment are corrupt");
+
+    uint8_t flags0 = (uint8_t) buffer0[4];
+    uint8_t flags1 = (uint8_t) buffer1[4];
+    if (valid0 && valid1)
+        env->active = is_newer(flags1, flags0) ? 1 : 0;
+    else
+        env->active = valid1 ? 1 : 0;
+
+    env->flags = env->active ? flags1 : flags0;
+    return parse(env, env->active ? buffer1 : buffer0);
 }
 
-static void uboot_env_sort(struct uboot_env *env)
+// Names end at the first '=' when the environment is read back
+bool uboot_env_name_valid(const char *name)
 {
-    int count = 0;
-    struct uboot_name_value *pair;
-    for (pair = env->vars; pair != NULL; pair = pair->next)
-        count++;
-
-    if (count == 0)
-        return;
+    return *name != '\0' && strchr(name, '=') == NULL;
+}
 
-    struct uboot_name_value **pairarray =
-        (struct uboot_name_value **) malloc(count * sizeof(struct uboot_name_value *));
-    int i;
-    for (pair = env->vars, i = 0; pair != NULL; pair = pair->next, i++)
-        pairarray[i] = pair;
+int uboot_env_setenv(struct uboot_env *env, const char *name, const char *value)
+{
+    if (!uboot_env_name_valid(name))
+        ERR_RETURN("Invalid U-Boot variable name '%s'", name);
+
+    uint32_t hash = hash_bytes(name, strlen(name));
+    struct uboot_name_value *pair = lookup(env, name, hash);
+    if (pair) {
+        // The old value stays in the block or arena until uboot_env_free().
+        pair->value = arena_strdup(env, value);
+        return 0;
+    }
 
-    qsort(pairarray, count, sizeof(struct uboot_name_value *), env_name_compare);
+    insert(env, arena_strdup(env, name), arena_strdup(env, value), hash);
+    return 0;
+}
 
-    for (i = 0; i < count - 1; i++)
-        pairarray[i]->next = pairarray[i + 1];
-    pairarray[count - 1]->next = NULL;
-    env->vars = pairarray[0];
+int uboot_env_getenv(struct uboot_env *env, const char *name, const char **value)
+{
+    struct uboot_name_value *pair = lookup(env, name, hash_bytes(name, strlen(name)));
+    if (pair) {
+        *value = pair->value;
+        return 0;
+    }
 
-    free(pairarray);
+    *value = NULL;
+    ERR_RETURN("variable '%s' not found", name);
 }
 
 int uboot_env_write(struct uboot_env *env, char *buffer)
@@ -174,17 +308,17 @@ int uboot_env_write(struct uboot_env *env, char *buffer)
     // U-boot environment blocks are filled by 0xff by default
     memset(buffer, 0xff, env->env_size);
 
-    // Skip over the CRC until the end.
-    char *p = buffer + 4;
+    // Skip over the CRC until the end. Redundant environments get the next
+    // flags value so that this copy becomes the newest one once it's saved.
+    char *p = buffer + header_size(env);
     char *end = buffer + env->env_size - 2;
+    if (env->redundant)
+        buffer[4] = (char) (env->flags + 1);
 
-    // Sort the name/value pairs so that their ordering is
-    // deterministic.
-    uboot_env_sort(env);
-
-    // Add all of the name/value pairs.
-    struct uboot_name_value *pair;
-    for (pair = env->vars; pair != NULL; pair = pair->next) {
+    // Add all of the name/value pairs. They're already sorted so that the
+    // ordering is deterministic.
+    for (size_t i = 0; i < env->count; i++) {
+        const struct uboot_name_value *pair = env->vars[i];
         size_t namelen = strlen(pair->name);
         size_t valuelen = strlen(pair->value);
         if (p + namelen + 1 + valuelen >= end)
@@ -204,7 +338,7 @@ int uboot_env_write(struct uboot_env *env, char *buffer)
     *p = 0;
 
     // Calculate and add the CRC-32
-    uint32_t crc32 = crc32buf(buffer + 4, env->env_size - 4);
+    uint32_t crc32 = crc32buf(buffer + header_size(env), env->env_size - header_size(env));
     buffer[0] = crc32 & 0xff;
     buffer[1] = (crc32 >> 8) & 0xff;
     buffer[2] = (crc32 >> 16) & 0xff;
@@ -215,15 +349,20 @@ int uboot_env_write(struct uboot_env *env, char *buffer)
 
 void uboot_env_free(struct uboot_env *env)
 {
-    struct uboot_name_value *pair = env->vars;
-    while (pair != NULL) {
-        free(pair->name);
-        free(pair->value);
-
-        struct uboot_name_value *next = pair->next;
-        free(pair);
-        pair = next;
+    struct uboot_arena_chunk *chunk = env->arena;
+    while (chunk != NULL) {
+        struct uboot_arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
     }
+    env->arena = NULL;
 
+    free(env->vars);
     env->vars = NULL;
+    env->count = 0;
+    env->capacity = 0;
+
+    free(env->index);
+    env->index = NULL;
+    env->index_size = 0;
 }
@@ -17,26 +17,47 @@
 #ifndef UBOOT_ENV_H
 #define UBOOT_ENV_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
 struct uboot_name_value {
-    char *name;
-    char *value;
-    struct uboot_name_value *next;
+    const char *name;
+    const char *value;
+    uint32_t hash;
 };
 
+struct uboot_arena_chunk;
+
 struct uboot_env {
     size_t env_size;
 
-    struct uboot_name_value *vars;
+    // CONFIG_SYS_REDUNDAND_ENVIRONMENT layout. active is the copy (0 or 1)
+    // that was loaded and flags is its flags byte.
+    bool redundant;
+    int active;
+    uint8_t flags;
+
+    // Everything, including the copy of the raw environment block that
+    // unmodified names and values point into, is allocated from the arena.
+    struct uboot_arena_chunk *arena;
+
+    // Variables sorted by name so that they can be written in one pass
+    struct uboot_name_value **vars;
+    size_t count;
+    size_t capacity;
+
+    // Hash index over vars for constant time lookups
+    struct uboot_name_value **index;
+    size_t index_size;
 };
 
 void uboot_env_init(struct uboot_env *env);
 int uboot_env_read(struct uboot_env *env, const char *buffer);
+int uboot_env_read_redundant(struct uboot_env *env, const char *buffer0, const char *buffer1);
+bool uboot_env_name_valid(const char *name);
 int uboot_env_setenv(struct uboot_env *env, const char *name, const char *value);
-int uboot_env_unsetenv(struct uboot_env *env, const char *name);
-int uboot_env_getenv(struct uboot_env *env, const char *name, char **value);
+int uboot_env_getenv(struct uboot_env *env, const char *name, const char **value);
 int uboot_env_write(struct uboot_env *env, char *buffer);
 void uboot_env_free(struct uboot_env *env);
 
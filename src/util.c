@@ -29,66 +29,158 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <syslog.h>
 #include <unistd.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 
-static int format_message(char **strp, const char *fmt, va_list ap)
-{
-    char *msg;
-    if (vasprintf(&msg, fmt, ap) < 0) {
-        return -1;
-    }
+// Long enough for paths and command lines. Longer messages are truncated.
+#define LOG_LINE_MAX 512
+
+// Lines above the log level are held here in case there's a fatal error.
+#define LOG_DEFERRED_SIZE 4096
 
-    int rc = asprintf(strp, PROGRAM_NAME ": %s\r\n", msg);
-    free(msg);
+static int log_fd = -1;
+static int log_level =
+#ifdef DEBUG
+    LOG_DEBUG;
+#else
+    LOG_INFO;
+#endif
 
-    return rc;
+static char deferred[LOG_DEFERRED_SIZE];
+static size_t deferred_len = 0;
+
+static void log_open()
+{
+    // Keep /dev/kmsg open for the life of the program. It's closed on the
+    // exec to the next init.
+    if (log_fd < 0)
+        log_fd = open("/dev/kmsg", O_WRONLY | O_CLOEXEC);
 }
 
 static void log_write(const char *str, size_t len)
 {
-    size_t ignore;
-    int log_fd = open("/dev/kmsg", O_WRONLY | O_CLOEXEC);
+    ssize_t ignore;
+
+    log_open();
     if (log_fd >= 0) {
         ignore = write(log_fd, str, len);
-        close(log_fd);
     } else {
+        // The priority is only meaningful to the kernel
+        if (str[0] == '<' && len > 3 && str[2] == '>') {
+            str += 3;
+            len -= 3;
+        }
         ignore = write(STDERR_FILENO, str, len);
     }
     (void) ignore;
 }
 
-static void log_format(const char *fmt, va_list ap)
+static void log_defer(const char *str, size_t len)
 {
-    char *line;
-    int len = format_message(&line, fmt, ap);
+    if (len > sizeof(deferred))
+        return;
+
+    // Drop the oldest lines to make room
+    size_t start = 0;
+    while (deferred_len - start + len > sizeof(deferred)) {
+        char *eol = memchr(deferred + start, '\n', deferred_len - start);
+        start = eol ? (size_t) (eol - deferred) + 1 : deferred_len;
+    }
+    memmove(deferred, deferred + start, deferred_len - start);
+    deferred_len -= start;
 
-    if (len >= 0) {
-        log_write(line, len);
-        free(line);
+    memcpy(deferred + deferred_len, str, len);
+    deferred_len += len;
+}
+
+static void log_flush_deferred()
+{
+    // Each line needs to be a separate write to be a separate kmsg record
+    size_t start = 0;
+    while (start < deferred_len) {
+        char *eol = memchr(deferred + start, '\n', deferred_len - start);
+        size_t end = eol ? (size_t) (eol - deferred) + 1 : deferred_len;
+        log_write(deferred + start, end - start);
+        start = end;
     }
+    deferred_len = 0;
+}
+
+static void log_format(int priority, const char *fmt, va_list ap)
+{
+    char line[LOG_LINE_MAX];
+    int prefix_len = snprintf(line, sizeof(line), "<%d>" PROGRAM_NAME ": ", priority);
+
+    // Leave room for the "\r\n"
+    size_t max_len = sizeof(line) - 2;
+    int len = vsnprintf(line + prefix_len, max_len - prefix_len, fmt, ap);
+    if (len < 0)
+        return;
+
+    len += prefix_len;
+    if ((size_t) len >= max_len)
+        len = max_len - 1;
+    line[len++] = '\r';
+    line[len++] = '\n';
+
+    if (priority <= log_level)
+        log_write(line, len);
+    else
+        log_defer(line, len);
+}
+
+void log_set_level(int level)
+{
+    log_level = level;
+}
+
+int log_get_level()
+{
+    return log_level;
 }
 
 void info(const char *fmt, ...)
 {
     va_list ap;
     va_start(ap, fmt);
-    log_format(fmt, ap);
+    log_format(LOG_INFO, fmt, ap);
+    va_end(ap);
+}
+
+void warn(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    log_format(LOG_WARNING, fmt, ap);
     va_end(ap);
 }
 
+#ifdef DEBUG
+void debug(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    log_format(LOG_DEBUG, fmt, ap);
+    va_end(ap);
+}
+#endif
+
 void fatal(const char *fmt, ...)
 {
-    log_write("\r\n\r\nFATAL ERROR:\r\n", 18);
+    // Everything that was held back might help explain what happened
+    log_flush_deferred();
+
+    log_write("<2>\r\n\r\nFATAL ERROR:\r\n", 21);
 
     va_list ap;
     va_start(ap, fmt);
-    log_format(fmt, ap);
+    log_format(LOG_CRIT, fmt, ap);
     va_end(ap);
 
-    log_write("\r\n\r\nCANNOT CONTINUE.\r\n", 22);
+    log_write("<2>\r\n\r\nCANNOT CONTINUE.\r\n", 25);
 
     // This will cause the kernel to panic.
     exit(1);
@@ -108,3 +200,15 @@ void trim_string_in_place(char *str)
     memmove(str, first, len);
     str[len] = '\0';
 }
+
+// 32-bit FNV-1a. Fast and good enough for the small tables used here.
+uint32_t hash_bytes(const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
@@ -31,26 +31,33 @@
 
 //#define DEBUG 1
 
-// Logging functions
+// Logging functions. Messages go to /dev/kmsg with syslog priorities so
+// that the kernel's console loglevel applies to them.
 void info(const char *fmt, ...);
+void warn(const char *fmt, ...);
 void fatal(const char *fmt, ...);
 
+// Messages less important than the level are only written if there's a
+// fatal error. Levels are the syslog ones (0-7).
+void log_set_level(int level);
+int log_get_level(void);
+
 #define ERR_CLEANUP() do { rc = -1; goto cleanup; } while (0)
-#define ERR_CLEANUP_MSG(MSG, ...) do { info(MSG, ## __VA_ARGS__); rc = -1; goto cleanup; } while (0)
+#define ERR_CLEANUP_MSG(MSG, ...) do { warn(MSG, ## __VA_ARGS__); rc = -1; goto cleanup; } while (0)
 
 #define OK_OR_CLEANUP(WORK) do { if ((WORK) < 0) ERR_CLEANUP(); } while (0)
 #define OK_OR_CLEANUP_MSG(WORK, MSG, ...) do { if ((WORK) < 0) ERR_CLEANUP_MSG(MSG, ## __VA_ARGS__); } while (0)
 
-#define ERR_RETURN(MSG, ...) do { info(MSG, ## __VA_ARGS__); return -1; } while (0)
+#define ERR_RETURN(MSG, ...) do { warn(MSG, ## __VA_ARGS__); return -1; } while (0)
 #define OK_OR_RETURN(WORK) do { if ((WORK) < 0) return -1; } while (0)
 #define OK_OR_RETURN_MSG(WORK, MSG, ...) do { if ((WORK) < 0) ERR_RETURN(MSG, ## __VA_ARGS__); } while (0)
 
 #define OK_OR_FATAL(WORK, MSG, ...) do { if ((WORK) < 0) fatal(MSG, ## __VA_ARGS__); } while (0)
-#define OK_OR_WARN(WORK, MSG, ...) do { if ((WORK) < 0) info(MSG, ## __VA_ARGS__); } while (0)
+#define OK_OR_WARN(WORK, MSG, ...) do { if ((WORK) < 0) warn(MSG, ## __VA_ARGS__); } while (0)
 
 #ifdef DEBUG
-#define debug info
-#define OK_OR_DEBUG(WORK, MSG, ...) do { if ((WORK) < 0) info(MSG, ## __VA_ARGS__); } while (0)
+void debug(const char *fmt, ...);
+#define OK_OR_DEBUG(WORK, MSG, ...) do { if ((WORK) < 0) debug(MSG, ## __VA_ARGS__); } while (0)
 #define assert(CONDITION) do { if (!(CONDITION)) fatal("assert failed at %s:%d", __FILE__, __LINE__); } while (0)
 #else
 #define debug(MSG, ...)
@@ -64,6 +71,7 @@ void fatal(const char *fmt, ...);
 
 // String functions
 void trim_string_in_place(char *str);
+uint32_t hash_bytes(const void *data, size_t len);
 
 // Globals
 extern struct uboot_env working_uboot_env;
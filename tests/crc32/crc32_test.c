@@ -0,0 +1,61 @@
+// Check that every CRC-32 implementation matches the original byte at a
+// time table lookup for all lengths and alignments that matter.
+#include "crc32.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LEN 1024
+#define MAX_ALIGN 16
+
+static int failures = 0;
+
+static void check(const char *name, uint32_t expected, uint32_t actual, size_t len, size_t align)
+{
+    if (expected != actual) {
+        fprintf(stderr, "%s: expected 0x%08x, got 0x%08x (len %zu, align %zu)\n",
+                name, expected, actual, len, align);
+        failures++;
+    }
+}
+
+int main()
+{
+    printf("Using %s\n", crc32_implementation());
+
+    // Standard check value
+    check("crc32buf", 0xcbf43926, crc32buf("123456789", 9), 9, 0);
+
+    static uint8_t buffer[MAX_LEN + MAX_ALIGN];
+    srand(1);
+    for (size_t i = 0; i < sizeof(buffer); i++)
+        buffer[i] = (uint8_t) rand();
+
+    for (size_t align = 0; align < MAX_ALIGN; align++) {
+        for (size_t len = 0; len <= MAX_LEN; len++) {
+            const uint8_t *p = buffer + align;
+            uint32_t expected = crc32_update_bytewise(0xffffffff, p, len);
+
+            check("slicing8", expected, crc32_update_slicing8(0xffffffff, p, len), len, align);
+            check("crc32_update", expected, crc32_update(0xffffffff, p, len), len, align);
+            check("crc32buf", ~expected, crc32buf((const char *) p, len), len, align);
+        }
+    }
+
+    // Incremental updates should match one big update
+    uint32_t crc = 0xffffffff;
+    for (size_t offset = 0; offset < MAX_LEN; offset += 100) {
+        size_t len = MAX_LEN - offset < 100 ? MAX_LEN - offset : 100;
+        crc = crc32_update(crc, buffer + offset, len);
+    }
+    check("incremental", crc32_update_bytewise(0xffffffff, buffer, MAX_LEN), crc, MAX_LEN, 0);
+
+    if (failures) {
+        fprintf(stderr, "%d failures\n", failures);
+        return EXIT_FAILURE;
+    }
+
+    printf("Pass!\n");
+    return EXIT_SUCCESS;
+}
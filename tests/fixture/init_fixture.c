@@ -6,6 +6,9 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifndef __APPLE__
+#include <sys/sysmacros.h>
+#endif
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
@@ -18,26 +21,48 @@
 #include <sys/ioctl.h>
 #include <linux/dm-ioctl.h>
 #include <linux/loop.h>
+#include <mtd/mtd-user.h>
 #include <net/if.h>
 #include <glob.h>
+#include <spawn.h>
 #include <termios.h>
+#include <errno.h>
 
 #define log(MSG, ...) do { fprintf(stderr, "fixture: " MSG "\n", ## __VA_ARGS__); } while (0)
 
+// Call counts for benchmarking. Every replacement function bumps its own
+// counter with COUNT().
+struct fixture_counter
+{
+    const char *name;
+    unsigned long count;
+    struct fixture_counter *next;
+};
+
+static struct fixture_counter *counters = NULL;
+
+#define COUNTER(name) \
+    static struct fixture_counter counter_##name = {#name, 0, NULL}; \
+    __attribute__((constructor)) static void register_##name() { counter_##name.next = counters; counters = &counter_##name; }
+#define COUNT(name) counter_##name.count++
+
 #ifndef __APPLE__
 #define ORIGINAL(name) original_##name
 #define REPLACEMENT(name) name
 #define OVERRIDE(ret, name, args) \
+    COUNTER(name) \
     static ret (*original_##name) args; \
     __attribute__((constructor)) void init_##name() { ORIGINAL(name) = dlsym(RTLD_NEXT, #name); } \
     ret REPLACEMENT(name) args
 
 #define REPLACE(ret, name, args) \
+    COUNTER(name) \
     ret REPLACEMENT(name) args
 #else
 #define ORIGINAL(name) name
 #define REPLACEMENT(name) new_##name
 #define OVERRIDE(ret, name, args) \
+    COUNTER(name) \
     ret REPLACEMENT(name) args; \
     __attribute__((used)) static struct { const void *original; const void *replacement; } _interpose_##name \
     __attribute__ ((section ("__DATA,__interpose"))) = { (const void*)(unsigned long)&REPLACEMENT(name), (const void*)(unsigned long)&ORIGINAL(name) }; \
@@ -46,24 +71,217 @@
 #define REPLACE(ret, name, args) OVERRIDE(ret, name, args)
 #endif
 
+#define FAKE_MTD_ERASESIZE 8192
+
 static pid_t starting_pid = 1;
 static const char *work = NULL;
 static bool remounted_root = false;
 
+// Set FIXTURE_STATS to a path to have counts and the run time appended
+// to it when init exits or execs the next init.
+static const char *stats_path = NULL;
+static struct timespec start_time;
+static unsigned long alloc_count = 0;
+static unsigned long long alloc_bytes = 0;
+
+// Slow media and late devices
+//
+// Set FIXTURE_LATENCY to a list of rules separated by semicolons. Each rule
+// is a path (or a prefix ending in '*'), a colon, and comma-separated
+// options:
+//
+//   appear=TIME     - the path doesn't exist until TIME after init starts
+//   latency=TIME    - added to every open, read, write and ioctl
+//   bandwidth=RATE  - reads and writes take bytes/RATE seconds
+//
+// TIME can end in us, ms or s. RATE is bytes/second and can end in K or M.
+// For example, "/dev/sda2:appear=400ms;/dev/mmcblk0:bandwidth=2M;/dev/kmsg:bandwidth=11520"
+#define MAX_LATENCY_RULES 64
+#define MAX_LATENCY_FDS   1024
+
+struct latency_rule
+{
+    char path[128];
+    bool prefix;
+    long long appear_us;
+    long long latency_us;
+    long long bytes_per_second;
+};
+
+static struct latency_rule latency_rules[MAX_LATENCY_RULES];
+static int latency_rule_count = 0;
+static const struct latency_rule *fd_rules[MAX_LATENCY_FDS];
+
+static long long parse_scaled(const char *value, const char *unit_names[], const long long unit_scales[])
+{
+    char *units;
+    long long number = strtoll(value, &units, 10);
+    for (int i = 0; unit_names[i]; i++) {
+        if (strcmp(units, unit_names[i]) == 0)
+            return number * unit_scales[i];
+    }
+    errx(EXIT_FAILURE, "FIXTURE_LATENCY: bad units in \"%s\"", value);
+}
+
+static long long parse_time_us(const char *value)
+{
+    static const char *names[] = {"", "us", "ms", "s", NULL};
+    static const long long scales[] = {1, 1, 1000, 1000000};
+    return parse_scaled(value, names, scales);
+}
+
+static long long parse_rate(const char *value)
+{
+    static const char *names[] = {"", "K", "M", NULL};
+    static const long long scales[] = {1, 1024, 1024 * 1024};
+    return parse_scaled(value, names, scales);
+}
+
+static void parse_latency_rules(const char *spec)
+{
+    if (!spec)
+        return;
+
+    char *rules = strdup(spec);
+    char *rule_save;
+    for (char *rule = strtok_r(rules, ";", &rule_save); rule; rule = strtok_r(NULL, ";", &rule_save)) {
+        char *options = strchr(rule, ':');
+        if (!options || latency_rule_count == MAX_LATENCY_RULES)
+            errx(EXIT_FAILURE, "FIXTURE_LATENCY: can't use \"%s\"", rule);
+        *options++ = '\0';
+
+        struct latency_rule *r = &latency_rules[latency_rule_count++];
+        memset(r, 0, sizeof(*r));
+        size_t len = strlen(rule);
+        if (len > 0 && rule[len - 1] == '*') {
+            r->prefix = true;
+            rule[--len] = '\0';
+        }
+        snprintf(r->path, sizeof(r->path), "%s", rule);
+
+        char *option_save;
+        for (char *option = strtok_r(options, ",", &option_save); option; option = strtok_r(NULL, ",", &option_save)) {
+            char *value = strchr(option, '=');
+            if (!value)
+                errx(EXIT_FAILURE, "FIXTURE_LATENCY: expecting a value for \"%s\"", option);
+            *value++ = '\0';
+
+            if (strcmp(option, "appear") == 0)
+                r->appear_us = parse_time_us(value);
+            else if (strcmp(option, "latency") == 0)
+                r->latency_us = parse_time_us(value);
+            else if (strcmp(option, "bandwidth") == 0)
+                r->bytes_per_second = parse_rate(value);
+            else
+                errx(EXIT_FAILURE, "FIXTURE_LATENCY: unknown option \"%s\"", option);
+        }
+    }
+    free(rules);
+}
+
+static const struct latency_rule *find_latency_rule(const char *path)
+{
+    for (int i = 0; i < latency_rule_count; i++) {
+        const struct latency_rule *r = &latency_rules[i];
+        if (r->prefix ? strncmp(path, r->path, strlen(r->path)) == 0 : strcmp(path, r->path) == 0)
+            return r;
+    }
+    return NULL;
+}
+
+static long long elapsed_us()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start_time.tv_sec) * 1000000LL +
+           (now.tv_nsec - start_time.tv_nsec) / 1000;
+}
+
+static void delay_us(long long us)
+{
+    if (us <= 0)
+        return;
+
+    struct timespec ts = {us / 1000000, (us % 1000000) * 1000};
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+        ;
+}
+
+// Returns true if the path shouldn't exist yet
+static bool not_there_yet(const struct latency_rule *r)
+{
+    if (r && elapsed_us() < r->appear_us) {
+        errno = ENOENT;
+        return true;
+    }
+    return false;
+}
+
+static void track_fd(int fd, const struct latency_rule *r)
+{
+    if (fd >= 0 && fd < MAX_LATENCY_FDS)
+        fd_rules[fd] = r;
+}
+
+// Delay an operation on a file descriptor that transfers count bytes
+static void delay_fd(int fd, size_t count)
+{
+    if (fd < 0 || fd >= MAX_LATENCY_FDS || !fd_rules[fd])
+        return;
+
+    const struct latency_rule *r = fd_rules[fd];
+    long long us = r->latency_us;
+    if (r->bytes_per_second)
+        us += (long long) count * 1000000LL / r->bytes_per_second;
+    delay_us(us);
+}
+
 __attribute__((constructor)) void fixture_init()
 {
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
     // WARNING: This is hacky!!!
     starting_pid = getpid();
     if (starting_pid == 1)
         errx(EXIT_FAILURE, "getpid() overridden before it should have been");
 
     work = getenv("WORK");
+    stats_path = getenv("FIXTURE_STATS");
+    parse_latency_rules(getenv("FIXTURE_LATENCY"));
 
     // Don't wrap child processes
     unsetenv("LD_PRELOAD");
     unsetenv("DYLD_INSERT_LIBRARIES");
 }
 
+#ifdef __GLIBC__
+// Count allocations. These can't use dlsym() since it allocates.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+    alloc_count++;
+    alloc_bytes += size;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    alloc_count++;
+    alloc_bytes += nmemb * size;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    alloc_count++;
+    alloc_bytes += size;
+    return __libc_realloc(ptr, size);
+}
+#endif
+
 static int fixup_path(const char *input, char *output)
 {
     // All paths from init should be absolute
@@ -91,6 +309,7 @@ static void unfixup_path(char *path)
 #ifdef __APPLE__
 REPLACE(int, mount, (const char *type, const char *dir, int flags, void *data))
 {
+    COUNT(mount);
     // See compat.h for how we put the filesystemtype in the data so that we
     // can print it out here.
     const char *filesystemtype = data;
@@ -105,6 +324,7 @@ REPLACE(int, mount, (const char *type, const char *dir, int flags, void *data))
 
 REPLACE(int, unmount, (const char *target, int flags))
 {
+    COUNT(unmount);
     (void) flags;
 
     log("umount(\"%s\")", target);
@@ -115,10 +335,15 @@ REPLACE(int, mount, (const char *source, const char *target,
           const char *filesystemtype, unsigned long mountflags,
           const void *data))
 {
+    COUNT(mount);
     (void) data;
 
     log("mount(\"%s\", \"%s\", \"%s\", %lu, data)", source, target, filesystemtype, mountflags);
 
+    const struct latency_rule *r = find_latency_rule(source);
+    if (r)
+        delay_us(r->latency_us);
+
     if (strcmp(source, ".") == 0 && strcmp(target, "/") == 0)
         remounted_root = true;
 
@@ -127,13 +352,28 @@ REPLACE(int, mount, (const char *source, const char *target,
 
 REPLACE(int, umount, (const char *target))
 {
+    COUNT(umount);
     log("umount(\"%s\")", target);
     return 0;
 }
+
+REPLACE(int, umount2, (const char *target, int flags))
+{
+    COUNT(umount2);
+    log("umount2(\"%s\", %d)", target, flags);
+    return 0;
+}
 #endif
 
 OVERRIDE(FILE *, fopen, (const char *pathname, const char *mode))
 {
+    COUNT(fopen);
+    const struct latency_rule *r = find_latency_rule(pathname);
+    if (not_there_yet(r))
+        return NULL;
+    if (r)
+        delay_us(r->latency_us);
+
     char new_path[PATH_MAX];
     if (fixup_path(pathname, new_path) < 0)
         return NULL;
@@ -143,6 +383,7 @@ OVERRIDE(FILE *, fopen, (const char *pathname, const char *mode))
 
 OVERRIDE(pid_t, getpid, ())
 {
+    COUNT(getpid);
     pid_t real_pid = ORIGINAL(getpid)();
     if (real_pid == starting_pid)
         return 1;
@@ -152,12 +393,14 @@ OVERRIDE(pid_t, getpid, ())
 
 REPLACE(int, reboot, (int cmd))
 {
+    COUNT(reboot);
     log("reboot(0x%08x)", cmd);
     exit(0);
 }
 
 REPLACE(int, clock_settime, (clockid_t clk_id, const struct timespec *tp))
 {
+    COUNT(clock_settime);
     (void) clk_id;
     (void) tp;
 
@@ -167,30 +410,39 @@ REPLACE(int, clock_settime, (clockid_t clk_id, const struct timespec *tp))
 
 REPLACE(int, setuid, (uid_t uid))
 {
+    COUNT(setuid);
     log("setuid(%d)", uid);
     return 0;
 }
 
 REPLACE(int, setgid, (gid_t gid))
 {
+    COUNT(setgid);
     log("setgid(%d)", gid);
     return 0;
 }
 
-REPLACE(int, kill, (pid_t pid, int sig))
+OVERRIDE(int, kill, (pid_t pid, int sig))
 {
+    COUNT(kill);
+    // Let init signal the commands that it started, but nothing else
+    if (pid > 1 || pid < -1)
+        return ORIGINAL(kill)(pid, sig);
+
     log("kill(%d, %d)", pid, sig);
     return 0;
 }
 
 REPLACE(int, chroot, (const char *path))
 {
+    COUNT(chroot);
     log("chroot(%s)", path);
     return 0;
 }
 
 OVERRIDE(int, open, (const char *pathname, int flags, ...))
 {
+    COUNT(open);
     int mode;
 
     va_list ap;
@@ -201,15 +453,25 @@ OVERRIDE(int, open, (const char *pathname, int flags, ...))
         mode = 0;
     va_end(ap);
 
-    // Log to stderr
-    if (strcmp(pathname, "/dev/kmsg") == 0)
-        return dup(STDERR_FILENO);
-
-    char new_path[PATH_MAX];
-    if (fixup_path(pathname, new_path) < 0)
+    const struct latency_rule *r = find_latency_rule(pathname);
+    if (not_there_yet(r))
         return -1;
+    if (r)
+        delay_us(r->latency_us);
 
-    return ORIGINAL(open)(new_path, flags, mode);
+    // Log to stderr
+    int fd;
+    if (strcmp(pathname, "/dev/kmsg") == 0) {
+        fd = dup(STDERR_FILENO);
+    } else {
+        char new_path[PATH_MAX];
+        if (fixup_path(pathname, new_path) < 0)
+            return -1;
+
+        fd = ORIGINAL(open)(new_path, flags, mode);
+    }
+    track_fd(fd, r);
+    return fd;
 }
 
 #ifdef __APPLE__
@@ -218,18 +480,21 @@ REPLACE(int, sethostname, (const char *name, int len))
 REPLACE(int, sethostname, (const char *name, size_t len))
 #endif
 {
+    COUNT(sethostname);
     log("sethostname(\"%s\", %d)", name, (int) len);
     return 0;
 }
 
 REPLACE(pid_t, setsid, ())
 {
+    COUNT(setsid);
     log("setsid()");
     return 1;
 }
 
 OVERRIDE(int, mkdir, (const char *path, mode_t mode))
 {
+    COUNT(mkdir);
     log("mkdir(\"%s\", %03o)", path, mode);
 
     char new_path[PATH_MAX];
@@ -239,6 +504,7 @@ OVERRIDE(int, mkdir, (const char *path, mode_t mode))
 }
 REPLACE(int, rmdir, (const char *path))
 {
+    COUNT(rmdir);
     log("rmdir(\"%s\")", path);
 
     char new_path[PATH_MAX];
@@ -249,6 +515,7 @@ REPLACE(int, rmdir, (const char *path))
 
 OVERRIDE(unsigned int, sleep, (unsigned int seconds))
 {
+    COUNT(sleep);
     if (seconds >= 2) {
         // This is from the emulated sigtimedwait
         return ORIGINAL(sleep)(seconds);
@@ -260,6 +527,7 @@ OVERRIDE(unsigned int, sleep, (unsigned int seconds))
 
 OVERRIDE(int, scandir, (const char *dirp, struct dirent ***namelist, int (*filter)(const struct dirent *), int (*compar)(const struct dirent **, const struct dirent **)))
 {
+    COUNT(scandir);
     char new_path[PATH_MAX];
     if (fixup_path(dirp, new_path) < 0)
         return -1;
@@ -269,6 +537,7 @@ OVERRIDE(int, scandir, (const char *dirp, struct dirent ***namelist, int (*filte
 
 OVERRIDE(int, chdir, (const char * path))
 {
+    COUNT(chdir);
     char new_path[PATH_MAX];
     if (fixup_path(path, new_path) < 0)
         return -1;
@@ -278,6 +547,7 @@ OVERRIDE(int, chdir, (const char * path))
 
 OVERRIDE(int, execvp, (const char *file, char *const argv[]))
 {
+    COUNT(execvp);
     char new_path[PATH_MAX];
     if (fixup_path(file, new_path) < 0)
         return -1;
@@ -285,25 +555,139 @@ OVERRIDE(int, execvp, (const char *file, char *const argv[]))
     return ORIGINAL(execvp)(new_path, argv);
 }
 
+OVERRIDE(int, posix_spawnp, (pid_t *pid, const char *file,
+                             const posix_spawn_file_actions_t *file_actions,
+                             const posix_spawnattr_t *attrp,
+                             char *const argv[], char *const envp[]))
+{
+    COUNT(posix_spawnp);
+    char new_path[PATH_MAX];
+
+    // posix_spawn functions return the error rather than setting errno
+    if (fixup_path(file, new_path) < 0)
+        return ENAMETOOLONG;
+
+    return ORIGINAL(posix_spawnp)(pid, new_path, file_actions, attrp, argv, envp);
+}
+
+static void write_stats()
+{
+    static bool written = false;
+
+    // Only report on init and not the commands that it forks
+    if (!stats_path || written || ORIGINAL(getpid)() != starting_pid)
+        return;
+    written = true;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long wall_us = (now.tv_sec - start_time.tv_sec) * 1000000LL +
+                        (now.tv_nsec - start_time.tv_nsec) / 1000;
+    unsigned long allocs = alloc_count;
+    unsigned long long bytes = alloc_bytes;
+
+    int fd = ORIGINAL(open)(stats_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return;
+
+    unsigned long total = 0;
+    for (const struct fixture_counter *c = counters; c; c = c->next) {
+        if (c->count) {
+            dprintf(fd, "calls %s %lu\n", c->name, c->count);
+            total += c->count;
+        }
+    }
+    dprintf(fd, "calls total %lu\n", total);
+#ifdef __GLIBC__
+    dprintf(fd, "allocs %lu\n", allocs);
+    dprintf(fd, "alloc_bytes %llu\n", bytes);
+#else
+    (void) allocs;
+    (void) bytes;
+#endif
+    dprintf(fd, "wall_us %lld\n", wall_us);
+    close(fd);
+}
+
+__attribute__((destructor)) void fixture_exit()
+{
+    write_stats();
+}
+
 OVERRIDE(int, execv, (const char *file, char *const argv[]))
 {
+    COUNT(execv);
     char new_path[PATH_MAX];
     if (fixup_path(file, new_path) < 0)
         return -1;
 
+    // This is the end of init, so report now
+    write_stats();
+
     return ORIGINAL(execv)(new_path, argv);
 }
 
 OVERRIDE(int, dup2, (int oldfd, int newfd))
 {
+    COUNT(dup2);
     if (REPLACEMENT(getpid)() == 1)
         return oldfd;
 
     return ORIGINAL(dup2)(oldfd, newfd);
 }
 
+// Reads and writes are only slowed down. They're the main cost of probing
+// devices.
+OVERRIDE(ssize_t, read, (int fd, void *buf, size_t count))
+{
+    COUNT(read);
+    delay_fd(fd, count);
+    return ORIGINAL(read)(fd, buf, count);
+}
+
+OVERRIDE(ssize_t, pread, (int fd, void *buf, size_t count, off_t offset))
+{
+    COUNT(pread);
+    delay_fd(fd, count);
+    return ORIGINAL(pread)(fd, buf, count, offset);
+}
+
+OVERRIDE(ssize_t, write, (int fd, const void *buf, size_t count))
+{
+    COUNT(write);
+    delay_fd(fd, count);
+    return ORIGINAL(write)(fd, buf, count);
+}
+
+OVERRIDE(int, close, (int fd))
+{
+    COUNT(close);
+    track_fd(fd, NULL);
+    return ORIGINAL(close)(fd);
+}
+
+OVERRIDE(ssize_t, pwrite, (int fd, const void *buf, size_t count, off_t offset))
+{
+    COUNT(pwrite);
+    delay_fd(fd, count);
+    log("pwrite(%d bytes at %lld)", (int) count, (long long) offset);
+    return ORIGINAL(pwrite)(fd, buf, count, offset);
+}
+
+OVERRIDE(int, fdatasync, (int fd))
+{
+    COUNT(fdatasync);
+    log("fdatasync()");
+
+    // Syncing the host's disk would swamp everything else in benchmarks
+    if (stats_path)
+        return 0;
+    return ORIGINAL(fdatasync)(fd);
+}
+
 OVERRIDE(int, symlink, (const char *target, const char *linkpath))
 {
+    COUNT(symlink);
     log("symlink(\"%s\",\"%s\")", target, linkpath);
 
     char new_target[PATH_MAX];
@@ -319,6 +703,7 @@ OVERRIDE(int, symlink, (const char *target, const char *linkpath))
 
 OVERRIDE(int, link, (const char *target, const char *linkpath))
 {
+    COUNT(link);
     char new_target[PATH_MAX];
     if (fixup_path(target, new_target) < 0)
         return -1;
@@ -329,8 +714,25 @@ OVERRIDE(int, link, (const char *target, const char *linkpath))
 
     return ORIGINAL(link)(new_target, new_linkpath);
 }
+
+OVERRIDE(int, rename, (const char *oldpath, const char *newpath))
+{
+    COUNT(rename);
+    log("rename(\"%s\",\"%s\")", oldpath, newpath);
+
+    char new_oldpath[PATH_MAX];
+    if (fixup_path(oldpath, new_oldpath) < 0)
+        return -1;
+
+    char new_newpath[PATH_MAX];
+    if (fixup_path(newpath, new_newpath) < 0)
+        return -1;
+
+    return ORIGINAL(rename)(new_oldpath, new_newpath);
+}
 REPLACE(int, unlink, (const char *target))
 {
+    COUNT(unlink);
     log("unlink(\"%s\")", target);
 
     char new_target[PATH_MAX];
@@ -342,6 +744,7 @@ REPLACE(int, unlink, (const char *target))
 
 OVERRIDE(int, unlinkat, (int fd, const char *path, int flag))
 {
+    COUNT(unlinkat);
     if (flag == AT_REMOVEDIR) {
         log("unlinkat(\"%s\", AT_REMOVEDIR)", path);
     } else {
@@ -352,9 +755,42 @@ OVERRIDE(int, unlinkat, (int fd, const char *path, int flag))
 }
 
 
+// Devices made by bench/make_topology have their numbers in
+// /sys/class/block like on real systems
+static int sysfs_block_device_stat(const char *pathname, struct stat *st)
+{
+    if (strncmp(pathname, "/dev/", 5) != 0)
+        return -1;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/sys/class/block/%s/dev", work, pathname + 5);
+    FILE *fp = ORIGINAL(fopen)(path, "r");
+    if (!fp)
+        return -1;
+
+    unsigned int dev_major;
+    unsigned int dev_minor;
+    int rc = -1;
+    if (fscanf(fp, "%u:%u", &dev_major, &dev_minor) == 2) {
+#ifdef __APPLE__
+        st->st_rdev = (dev_major << 8) + dev_minor;
+#else
+        st->st_rdev = makedev(dev_major, dev_minor);
+#endif
+        st->st_mode = S_IFBLK;
+        rc = 0;
+    }
+    fclose(fp);
+    return rc;
+}
+
 #ifdef __APPLE__
 OVERRIDE(int, stat, (const char *pathname, struct stat *st))
 {
+    COUNT(stat);
+    if (not_there_yet(find_latency_rule(pathname)))
+        return -1;
+
     memset(st, 0, sizeof(struct stat));
     if (strcmp(pathname, "/dev/mmcblk0p0") == 0) {
         st->st_rdev = 0xb300;
@@ -384,6 +820,8 @@ OVERRIDE(int, stat, (const char *pathname, struct stat *st))
         st->st_rdev = 0x802;
         st->st_mode = S_IFBLK;
         return 0;
+    } else if (sysfs_block_device_stat(pathname, st) == 0) {
+        return 0;
     } else {
         char new_path[PATH_MAX];
         if (fixup_path(pathname, new_path) < 0)
@@ -394,6 +832,10 @@ OVERRIDE(int, stat, (const char *pathname, struct stat *st))
 #else
 OVERRIDE(int, __xstat, (int ver, const char *pathname, struct stat *st))
 {
+    COUNT(__xstat);
+    if (not_there_yet(find_latency_rule(pathname)))
+        return -1;
+
     memset(st, 0, sizeof(struct stat));
     if (strcmp(pathname, "/dev/mmcblk0p0") == 0) {
         st->st_rdev = 0xb300;
@@ -431,6 +873,8 @@ OVERRIDE(int, __xstat, (int ver, const char *pathname, struct stat *st))
         st->st_rdev = 0x802;
         st->st_mode = S_IFBLK;
         return 0;
+    } else if (sysfs_block_device_stat(pathname, st) == 0) {
+        return 0;
     } else {
         char new_path[PATH_MAX];
         if (fixup_path(pathname, new_path) < 0)
@@ -480,7 +924,8 @@ static int handle_dm_ioctl(unsigned long request, const struct dm_ioctl *dm)
 
 OVERRIDE(int, ioctl, (int fd, unsigned long request, ...))
 {
-    (void) fd;
+    COUNT(ioctl);
+    delay_fd(fd, 0);
     const char *req;
     switch (request) {
     case TIOCGWINSZ:
@@ -559,6 +1004,56 @@ OVERRIDE(int, ioctl, (int fd, unsigned long request, ...))
         break;
     }
 
+    case MEMGETINFO:
+    {
+        // Fake MTD devices are regular files with 8 KiB erase blocks
+        va_list ap;
+        va_start(ap, request);
+        struct mtd_info_user *info = va_arg(ap, struct mtd_info_user *);
+        va_end(ap);
+
+        struct stat st;
+        if (fstat(fd, &st) < 0)
+            return -1;
+
+        memset(info, 0, sizeof(*info));
+        info->type = MTD_NANDFLASH;
+        info->size = st.st_size;
+        info->erasesize = FAKE_MTD_ERASESIZE;
+        info->writesize = 512;
+        req = "MEMGETINFO";
+        break;
+    }
+    case MEMGETBADBLOCK:
+    {
+        // Erase blocks that start with "BADBLOCK" are bad
+        va_list ap;
+        va_start(ap, request);
+        const int64_t *offset = va_arg(ap, const int64_t *);
+        va_end(ap);
+
+        char marker[8];
+        bool bad = pread(fd, marker, sizeof(marker), *offset) == sizeof(marker) &&
+                   memcmp(marker, "BADBLOCK", sizeof(marker)) == 0;
+        log("ioctl(MEMGETBADBLOCK, %lld) -> %d", (long long) *offset, bad);
+        return bad;
+    }
+    case MEMERASE:
+    {
+        va_list ap;
+        va_start(ap, request);
+        const struct erase_info_user *erase = va_arg(ap, const struct erase_info_user *);
+        va_end(ap);
+
+        char *ff = malloc(erase->length);
+        memset(ff, 0xff, erase->length);
+        ssize_t amount_written = ORIGINAL(pwrite)(fd, ff, erase->length, erase->start);
+        free(ff);
+
+        log("ioctl(MEMERASE, %u, %u)", erase->start, erase->length);
+        return amount_written == (ssize_t) erase->length ? 0 : -1;
+    }
+
     default:
         log("unknown ioctl(0x%08lx)", request);
         req = "unknown";
@@ -568,8 +1063,9 @@ OVERRIDE(int, ioctl, (int fd, unsigned long request, ...))
     return 0;
 }
 
-OVERRIDE(int, glob, (const char *pattern, int flags, int (*errfunc)(const char *epath, int errno), glob_t *pglob))
+OVERRIDE(int, glob, (const char *pattern, int flags, int (*errfunc)(const char *epath, int eerrno), glob_t *pglob))
 {
+    COUNT(glob);
     if (pattern[0] == '/') {
         char new_pattern[PATH_MAX];
         if (fixup_path(pattern, new_pattern) < 0)
@@ -588,6 +1084,15 @@ OVERRIDE(int, glob, (const char *pattern, int flags, int (*errfunc)(const char *
 
 REPLACE(int, usleep, (useconds_t usec))
 {
+    COUNT(usleep);
+
+    // Really wait when devices can show up late. How many times that
+    // happens depends on timing, so don't log it.
+    if (latency_rule_count) {
+        delay_us(usec);
+        return 0;
+    }
+
     log("usleep(%d)", usec);
     return 0;
 }
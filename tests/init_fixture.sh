@@ -13,6 +13,8 @@ mkdir -p "$TEST_ROOTFS/usr/bin"
 ln -s "$TESTS_DIR/fake_fwup" "$TEST_ROOTFS/usr/bin/fwup"
 ln -s "$TESTS_DIR/fake_boardid" "$TEST_ROOTFS/usr/bin/boardid"
 ln -s "$TESTS_DIR/fake_faulty_program" "$TEST_ROOTFS/usr/bin/faulty_program"
+ln -s "$TESTS_DIR/fake_counter" "$TEST_ROOTFS/usr/bin/counter"
+ln -s "$TESTS_DIR/fake_hang" "$TEST_ROOTFS/usr/bin/hang"
 
 # Create the device containing a root filesystem
 dd if=/dev/zero of="$TEST_ROOTFS/dev/mmcblk0p2" bs=512 count=0 seek=1024 2>/dev/null
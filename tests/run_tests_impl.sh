@@ -59,6 +59,7 @@ run() {
     CONFIG=$TEST_ROOTFS/nerves_initramfs.conf
     POST_TEST_CHECK=$WORK/post-test.sh
     CMDLINE_FILE=$WORK/$TEST.cmdline
+    LATENCY_FILE=$WORK/$TEST.latency
     EXPECTED=$WORK/$TEST.expected
 
     echo Running $TEST...
@@ -77,10 +78,16 @@ run() {
         CMDLINE=
     fi
 
+    if [ -e "$LATENCY_FILE" ]; then
+        FIXTURE_LATENCY=$(cat "$LATENCY_FILE")
+    else
+        FIXTURE_LATENCY=
+    fi
+
     # Run init
     # NOTE: Call 'exec' so that it's possible to set argv0, but that means we
     #       need a subshell - hence the parentheses.
-    (LD_PRELOAD=$FIXTURE DYLD_INSERT_LIBRARIES=$FIXTURE WORK=$TEST_ROOTFS exec -a /init $INIT $CMDLINE) 2> $RESULTS.raw
+    (FIXTURE_LATENCY=$FIXTURE_LATENCY LD_PRELOAD=$FIXTURE DYLD_INSERT_LIBRARIES=$FIXTURE WORK=$TEST_ROOTFS exec -a /init $INIT $CMDLINE) 2> $RESULTS.raw
 
     # Trim the results of known lines that vary between runs
     # The calls to sed fixup differences between getopt implementations.